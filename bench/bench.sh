@@ -0,0 +1,135 @@
+#!/bin/bash
+## Headless, faster than real time benchmark of a synth patch.
+##
+## usage: bench/bench.sh [patch.pd [script.txt [tail-ms]]]
+##    with no patch, runs polysynthwt.pd, sy778vnofilt.pd and 101sequencer.pd
+##
+## The patch is rendered by Pd in -batch mode, which runs DSP as fast as the
+## machine allows and needs no audio or MIDI hardware (vanilla Pd 0.51 or
+## later; set PD to choose the binary).  Before loading, every .pd file of the
+## patch's directory is copied to a scratch directory with [dac~] replaced by
+## the [benchdac~] abstraction from bench/stubs, so the output is recorded by
+## benchhost.pd, and the stubs directory provides a [wiringPi] that swallows
+## all hardware messages.  Other files are linked so presets and tables load.
+##
+## Abstractions that take their notes through [inlet] instead of [notein],
+## or send audio to [throw~] instead of [dac~], are opened through
+## bench/hosts/<name>-host.pd, which feeds the notes of bench-note to the
+## inlet and records what the patch would play.
+##
+## The script is a qlist file: "<delay-ms> <receiver> <message>;" per line.
+## bench-note and bench-ctl reach every [notein] and [ctlin]; any other
+## receiver name reaches the patch directly.  After the last line the render
+## continues for tail-ms (default 2000) and Pd quits.
+##
+## Reported: wall time and speed against real time, per block DSP time from
+## [dspprof~ block tick] (min, mean, max, p99 in microseconds and percent of
+## the block period), the most notes the script holds at once (notes, not
+## synth voices: release tails and voice stealing are not counted), and a
+## sha256 of the rendered 8 channel float WAV.  Checksums are compared with
+## bench/baseline.txt; run with BENCH_UPDATE=1 to record new ones.
+##
+## dspprof~ must be compiled into pddspprof/ first; the run fails when Pd
+## cannot create it or it reports nothing, and when the render is silent,
+## rather than printing figures for an idle graph.
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+REPO=$(dirname "$BENCH")
+PD=${PD:-pd}
+OUT=${OUT:-/tmp/sy79bench}
+BASELINE=$BENCH/baseline.txt
+
+if ! ls "$REPO"/pddspprof/dspprof~.* > /dev/null 2>&1 ; then
+	echo "bench: no compiled dspprof~ in $REPO/pddspprof, build pddspprof.c first" >&2
+	exit 1
+fi
+
+benchone(){
+patch=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+script=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+tail=${3:-2000}
+name=$(basename "$patch" .pd)
+work=$OUT/$name
+rm -rf "$work" ; mkdir -p "$work"
+
+## Copy the patches with dac~ swapped for the recording stand-in, link the rest
+for f in "$(dirname "$patch")"/* ; do
+	case "$f" in
+	*.pd)	sed -e 's/^\(#X obj -*[0-9]* -*[0-9]*\) dac~\( *[;,]\)/\1 benchdac~ 1 2\2/' \
+		    -e 's/^\(#X obj -*[0-9]* -*[0-9]*\) dac~ /\1 benchdac~ /' \
+		    "$f" > "$work/$(basename "$f")" ;;
+	*)	ln -s "$f" "$work/" ;;
+	esac
+done
+open=$work/$name.pd
+if [ -f "$BENCH/hosts/$name-host.pd" ] ; then
+	cp "$BENCH/hosts/$name-host.pd" "$work/"
+	open=$work/$name-host.pd
+fi
+
+log=$work/pd.log
+start=$(date +%s.%N)
+"$PD" -batch -nogui -noprefs -nostdpath -stderr -r 44100 \
+	-path "$BENCH/stubs" -path "$REPO/pddspprof" -path "$work" \
+	-open "$open" -open "$BENCH/benchhost.pd" \
+	-send "bench-start $script $work/render.wav $tail" 2> "$log"
+status=$?
+end=$(date +%s.%N)
+
+if [ $status -ne 0 ] || [ ! -s "$work/render.wav" ] ; then
+	echo "$name: pd failed with status $status, see $log" >&2
+	return 1
+fi
+if grep -A1 "^dspprof~ " "$log" | grep -q "couldn't create" ; then
+	echo "$name: pd could not create dspprof~, see $log" >&2
+	return 1
+fi
+if ! grep -q "dspprof~:" "$log" ; then
+	echo "$name: no report from dspprof~, see $log" >&2
+	return 1
+fi
+
+## Samples follow the header of the float WAV: 8 channels of 4 bytes
+data=$(LC_ALL=C grep -obUa data "$work/render.wav" | head -1 | cut -d: -f1)
+if [ -z "$data" ] ; then
+	echo "$name: no data chunk in $work/render.wav" >&2
+	return 1
+fi
+if [ "$(tail -c +$((data + 9)) "$work/render.wav" | tr -d '\000' | head -c 1 | wc -c)" -eq 0 ] ; then
+	echo "$name: the render is silent, the script reached nothing that plays, see $log" >&2
+	return 1
+fi
+bytes=$(stat -c %s "$work/render.wav")
+seconds=$(awk "BEGIN { print ($bytes - $data - 8) / (8 * 4 * 44100) }")
+wall=$(awk "BEGIN { print $end - $start }")
+held=$(awk '$2 == "bench-note" { v = $4 + 0 ; k = $3 ; if (v > 0 && !(k in on)) { on[k] = 1 ; n++ } else if (v == 0 && (k in on)) { delete on[k] ; n-- } if (n > max) max = n } END { print max + 0 }' "$script")
+sum=$(sha256sum "$work/render.wav" | cut -d' ' -f1)
+key="$name $(basename "$script")"
+
+echo "== $name with $(basename "$script")"
+printf "wall %.2f s, rendered %.2f s, %.1fx real time, %s notes held at most by the script\n" \
+	"$wall" "$seconds" "$(awk "BEGIN { print $seconds / $wall }")" "$held"
+grep "dspprof~:" "$log" | sed 's/^dspprof~: */  /'
+
+if [ -n "$BENCH_UPDATE" ] ; then
+	touch "$BASELINE"
+	grep -v "^$key " "$BASELINE" > "$BASELINE.new" ; mv "$BASELINE.new" "$BASELINE"
+	echo "$key $sum" >> "$BASELINE"
+	echo "sha256 $sum (recorded)"
+elif grep -q "^$key " "$BASELINE" 2> /dev/null ; then
+	if grep -q "^$key $sum$" "$BASELINE" ; then echo "sha256 $sum (matches baseline)"
+	else echo "sha256 $sum (DIFFERS from baseline)" ; fi
+else
+	echo "sha256 $sum (no baseline)"
+fi
+}
+
+failed=0
+if [ $# -eq 0 ] ; then
+	for p in polysynthwt sy778vnofilt 101sequencer ; do
+		benchone "$REPO/files/$p.pd" "$BENCH/scripts/chords.txt" || failed=1
+	done
+else
+	benchone "$1" "${2:-$BENCH/scripts/chords.txt}" "$3" || failed=1
+fi
+exit $failed
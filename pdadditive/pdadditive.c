@@ -0,0 +1,227 @@
+/// pdadditive.c : Pd external for a block-vectorized additive oscillator
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+
+// [additive~] replaces the per-harmonic oscillator graphs of additiveosc.pd.
+// Every partial is a unit phasor rotated by a fixed complex factor each
+// sample, so a sine costs two multiply-adds instead of a table lookup.  The
+// partial state lives in parallel arrays and the inner loop runs across the
+// partials, which the compiler can vectorize.  Partial amplitudes come from a
+// Pd array read once per block and are ramped linearly across the block;
+// partials at or above Nyquist fade to zero and are dropped from the loop.
+// The per-sample sum is a float reduction, so build with -O3 -ffast-math as
+// Pd itself is built, otherwise the compiler keeps the loop scalar.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define ADDITIVE_MAX_PARTIALS 64      // a multiple of ADDITIVE_LANES
+#define ADDITIVE_LANES         4       // loop bounds are rounded up to whole vectors
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'additive~' object.
+typedef struct pdadditive
+{
+  t_object x_ob;           ///< standard object header
+  float sr;
+  float freq;              ///< fundamental in Hz
+  int partials;            ///< number of partials requested
+  int active;              ///< partials still sounding, the loop bound
+  t_symbol *array_name;    ///< amplitude table, one value per partial
+  t_word *array_vec;
+  int array_size;
+
+  // partial state, kept in parallel arrays for the vector loop
+  float re[ADDITIVE_MAX_PARTIALS] __attribute__ ((aligned (16)));   ///< phasor, real part
+  float im[ADDITIVE_MAX_PARTIALS] __attribute__ ((aligned (16)));   ///< phasor, imaginary part (output)
+  float rot_re[ADDITIVE_MAX_PARTIALS] __attribute__ ((aligned (16)));
+  float rot_im[ADDITIVE_MAX_PARTIALS] __attribute__ ((aligned (16)));
+  float amp[ADDITIVE_MAX_PARTIALS] __attribute__ ((aligned (16)));  ///< amplitude at the start of the block
+  float damp[ADDITIVE_MAX_PARTIALS] __attribute__ ((aligned (16))); ///< amplitude step per sample
+} t_pdadditive;
+
+static t_class *pdadditive_class;
+
+/****************************************************************/
+// Look up the amplitude array.  As with tabread~, this happens on [set] and
+// when DSP starts, and resizing the array restarts DSP.
+static void find_array( t_pdadditive *x )
+{
+  t_garray *a;
+  x->array_vec = NULL;
+  x->array_size = 0;
+  if ( !x->array_name || !*x->array_name->s_name ) return;
+  if ( !(a = (t_garray *) pd_findbyclass( x->array_name, garray_class ))) {
+    pd_error( x, "additive~: %s: no such array", x->array_name->s_name );
+  } else if ( !garray_getfloatwords( a, &x->array_size, &x->array_vec )) {
+    pd_error( x, "additive~: %s: bad template", x->array_name->s_name );
+    x->array_vec = NULL;
+    x->array_size = 0;
+  } else {
+    garray_usedindsp( a );
+  }
+}
+
+/****************************************************************/
+// Once per block: new rotation factors for the current pitch, amplitude ramps
+// toward the table values, and a renormalization step which stops the
+// recurrence from drifting off the unit circle.
+static void update_partials( t_pdadditive *x, int n )
+{
+  float nyquist = 0.5f * x->sr;
+  float w = 2.0f * (float) M_PI * x->freq / x->sr;
+  float inv_n = 1.0f / n;
+  int span = (x->partials + ADDITIVE_LANES - 1) & ~(ADDITIVE_LANES - 1);
+  int k, last = 0;
+
+  // partials between the requested count and the vector boundary run silent
+  for ( k = 0; k < span; k++ ) {
+    float hz = x->freq * (k + 1), target = 0;
+    float mag;
+
+    if ( hz < nyquist && k < x->partials && x->array_vec && k < x->array_size )
+      target = x->array_vec[k].w_float;
+    x->amp[k] += x->damp[k] * n;      // where the last ramp ended
+    x->damp[k] = (target - x->amp[k]) * inv_n;
+    if ( target != 0 || x->amp[k] != 0 ) last = k + 1;
+
+    x->rot_re[k] = cosf( w * (k + 1) );
+    x->rot_im[k] = sinf( w * (k + 1) );
+
+    mag = x->re[k] * x->re[k] + x->im[k] * x->im[k];
+    mag = 0.5f * (3.0f - mag);           // one Newton step toward 1/sqrt(mag)
+    x->re[k] *= mag;
+    x->im[k] *= mag;
+  }
+  x->active = (last + ADDITIVE_LANES - 1) & ~(ADDITIVE_LANES - 1);
+}
+
+/****************************************************************/
+static t_int *pdadditive_perform( t_int *w )
+{
+  t_pdadditive *x = (t_pdadditive *) w[1];
+  t_sample *out = (t_sample *) w[2];
+  int n = (int) w[3], i, k, active;
+  float *re = x->re, *im = x->im, *rr = x->rot_re, *ri = x->rot_im;
+  float *amp = x->amp, *damp = x->damp;
+
+  update_partials( x, n );
+  active = x->active;
+
+  for ( i = 0; i < n; i++ ) {
+    float sum = 0;
+    for ( k = 0; k < active; k++ ) {
+      float a = re[k], b = im[k];
+      re[k] = a * rr[k] - b * ri[k];
+      im[k] = a * ri[k] + b * rr[k];
+      sum += (amp[k] + damp[k] * i) * im[k];
+    }
+    out[i] = sum;
+  }
+  // partials which dropped out of the loop still need their phasor advanced
+  // by the block so that they come back in phase
+  for ( k = active; k < ADDITIVE_MAX_PARTIALS && k < x->partials + ADDITIVE_LANES; k++ ) {
+    float c = cosf( 2.0f * (float) M_PI * x->freq * (k + 1) * n / x->sr );
+    float s = sinf( 2.0f * (float) M_PI * x->freq * (k + 1) * n / x->sr );
+    float a = re[k], b = im[k];
+    re[k] = a * c - b * s;
+    im[k] = a * s + b * c;
+  }
+  return w + 4;
+}
+
+static void pdadditive_dsp( t_pdadditive *x, t_signal **sp )
+{
+  x->sr = sp[0]->s_sr;
+  find_array( x );
+  dsp_add( pdadditive_perform, 3, x, sp[0]->s_vec, (t_int) sp[0]->s_n );
+}
+
+/****************************************************************/
+/// A float sets the fundamental in Hz.
+static void pdadditive_float( t_pdadditive *x, t_floatarg f )
+{
+  x->freq = (f > 0) ? f : 0;
+}
+
+//  [ set <array> ]  choose the amplitude table
+static void pdadditive_set( t_pdadditive *x, t_symbol *s )
+{
+  x->array_name = s;
+  find_array( x );
+}
+
+//  [ partials <n> ]  number of partials, at most 64
+static void pdadditive_partials( t_pdadditive *x, t_floatarg f )
+{
+  int n = (int) f, k;
+  if ( n < 1 ) n = 1;
+  if ( n > ADDITIVE_MAX_PARTIALS ) n = ADDITIVE_MAX_PARTIALS;
+  for ( k = n; k < x->partials; k++ ) x->amp[k] = x->damp[k] = 0;
+  x->partials = n;
+}
+
+//  [ reset ]  restart every partial at phase zero, for a repeatable attack
+static void pdadditive_reset( t_pdadditive *x )
+{
+  int k;
+  for ( k = 0; k < ADDITIVE_MAX_PARTIALS; k++ ) {
+    x->re[k] = 1;
+    x->im[k] = 0;
+  }
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'additive~' object.
+///
+///  [ additive~ [array] [partials] ]  16 partials by default
+static void *pdadditive_new( t_symbol *array, t_floatarg partials )
+{
+  t_pdadditive *x = (t_pdadditive *) pd_new(pdadditive_class);
+
+  x->sr = sys_getsr();
+  x->freq = 0;
+  x->partials = 0;
+  x->active = 0;
+  memset( x->amp, 0, sizeof(x->amp) );
+  memset( x->damp, 0, sizeof(x->damp) );
+  pdadditive_reset( x );
+  pdadditive_partials( x, partials > 0 ? partials : 16 );
+  x->array_name = array;
+  x->array_vec = NULL;
+  x->array_size = 0;
+
+  outlet_new( &x->x_ob, &s_signal );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'additive~' external.
+void additive_tilde_setup(void)
+{
+  pdadditive_class = class_new( gensym("additive~"),
+				(t_newmethod) pdadditive_new,
+				0,
+				sizeof(t_pdadditive),
+				0,
+				A_DEFSYMBOL, A_DEFFLOAT, 0);
+
+  class_addmethod( pdadditive_class, (t_method) pdadditive_dsp, gensym("dsp"), A_CANT, 0 );
+  class_addfloat( pdadditive_class, pdadditive_float );
+  class_addmethod( pdadditive_class, (t_method) pdadditive_set, gensym("set"), A_SYMBOL, 0 );
+  class_addmethod( pdadditive_class, (t_method) pdadditive_partials, gensym("partials"), A_FLOAT, 0 );
+  class_addmethod( pdadditive_class, (t_method) pdadditive_reset, gensym("reset"), 0 );
+}
+
+/****************************************************************/
@@ -0,0 +1,394 @@
+/// pdarp.c : Pd external arpeggiator and chord engine
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+//   Pd clocks:         m_pd.h, clock_delay() and clock_gettimesince()
+
+// [arp] replaces the message logic of arpeggiator-plugin.pd and
+// basicsynthunisonarp.pd.  Held notes are kept in a sorted fixed-size array
+// (plus a copy in the order they were played), so a step only computes one
+// index into it: nothing is sorted or rebuilt while the pattern runs.
+//
+// Steps are scheduled against the time the pattern started rather than by
+// re-arming a [metro], so swing, gate and rate changes never accumulate
+// drift.  Every note leaves the object at its exact logical time, so a
+// [vline~] it drives is already placed inside the DSP block without any
+// delay; the third element of a note is the time in milliseconds since the
+// pattern started, for recording or lining up other sequencers.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define ARP_MAX_NOTES      32          ///< held notes
+#define ARP_MAX_OCTAVES    4
+#define ARP_MAX_SOUNDING   (ARP_MAX_NOTES * ARP_MAX_OCTAVES)
+
+enum { ARP_UP, ARP_DOWN, ARP_UPDOWN, ARP_RANDOM, ARP_PLAYED, ARP_CHORD, ARP_MODES };
+
+static const char *arp_mode_names[ARP_MODES] = { "up", "down", "updown", "random", "played", "chord" };
+
+/****************************************************************/
+typedef struct arp_note
+{
+  int pitch;
+  int velocity;
+} t_arp_note;
+
+/// Data structure to hold the state of a single Pd 'arp' object.
+typedef struct pdarp
+{
+  t_object x_ob;                        ///< standard object header
+  t_outlet *x_note_out;                 ///< <pitch> <velocity> <ms since start>, velocity 0 for note off
+  t_outlet *x_step_out;                 ///< step number, for displays
+  t_clock *x_step_clock;                ///< next step
+  t_clock *x_off_clock;                 ///< end of the gate of the current step
+
+  t_arp_note sorted[ARP_MAX_NOTES];     ///< held notes by ascending pitch
+  t_arp_note played[ARP_MAX_NOTES];     ///< held notes in the order they arrived
+  int held;
+
+  int sounding[ARP_MAX_SOUNDING];       ///< pitches waiting for their note off
+  int nsounding;
+
+  int mode;
+  int octaves;                          ///< 1 plays the held notes only
+  float gate;                           ///< fraction of the step a note sounds, 0-1
+  float swing;                          ///< delay of every second step as a fraction of a step
+  double period;                        ///< step length in ms
+
+  int running;
+  int step;                             ///< steps played since the start
+  double start;                         ///< logical time the pattern started
+  double base;                          ///< unswung time of the next step, ms after start
+  uint32_t seed;                        ///< random mode generator state
+} t_pdarp;
+
+static t_class *pdarp_class;
+
+/****************************************************************/
+// Held note bookkeeping.  Both arrays stay packed; a note already held only
+// has its velocity updated.
+static void hold_note( t_pdarp *x, int pitch, int velocity )
+{
+  int i, j;
+
+  for ( i = 0; i < x->held; i++ )
+    if ( x->sorted[i].pitch >= pitch ) break;
+  if ( i < x->held && x->sorted[i].pitch == pitch ) {
+    x->sorted[i].velocity = velocity;
+    for ( j = 0; j < x->held; j++ )
+      if ( x->played[j].pitch == pitch ) x->played[j].velocity = velocity;
+    return;
+  }
+  if ( x->held == ARP_MAX_NOTES ) {
+    post("arp: more than %d held notes, ignoring %d.", ARP_MAX_NOTES, pitch );
+    return;
+  }
+  memmove( &x->sorted[i + 1], &x->sorted[i], (x->held - i) * sizeof(t_arp_note) );
+  x->sorted[i].pitch = pitch;
+  x->sorted[i].velocity = velocity;
+  x->played[x->held].pitch = pitch;
+  x->played[x->held].velocity = velocity;
+  x->held++;
+}
+
+static void release_note( t_pdarp *x, int pitch )
+{
+  int i, j;
+
+  for ( i = 0; i < x->held; i++ )
+    if ( x->sorted[i].pitch == pitch ) break;
+  if ( i == x->held ) return;
+  for ( j = 0; j < x->held; j++ )
+    if ( x->played[j].pitch == pitch ) break;
+  x->held--;
+  memmove( &x->sorted[i], &x->sorted[i + 1], (x->held - i) * sizeof(t_arp_note) );
+  memmove( &x->played[j], &x->played[j + 1], (x->held - j) * sizeof(t_arp_note) );
+}
+
+/****************************************************************/
+static void send_note( t_pdarp *x, int pitch, int velocity )
+{
+  t_atom a[3];
+  SETFLOAT( &a[0], pitch );
+  SETFLOAT( &a[1], velocity );
+  SETFLOAT( &a[2], clock_gettimesince( x->start ));
+  outlet_list( x->x_note_out, &s_list, 3, a );
+}
+
+static void send_note_offs( t_pdarp *x )
+{
+  int i;
+  for ( i = 0; i < x->nsounding; i++ ) send_note( x, x->sounding[i], 0 );
+  x->nsounding = 0;
+}
+
+static void pdarp_off_tick( t_pdarp *x )
+{
+  send_note_offs( x );
+}
+
+/****************************************************************/
+// Pattern position of a step in a sequence of 'length' entries.
+static int pattern_index( t_pdarp *x, int step, int length )
+{
+  int period;
+
+  switch ( x->mode ) {
+  case ARP_DOWN:
+    return length - 1 - step % length;
+  case ARP_UPDOWN:
+    // the top and bottom notes are not repeated at the turns
+    period = (length > 1) ? 2 * length - 2 : 1;
+    step %= period;
+    return (step < length) ? step : period - step;
+  case ARP_RANDOM:
+    x->seed = x->seed * 1664525u + 1013904223u;
+    return (int) ((x->seed >> 8) % (uint32_t) length);
+  default:
+    return step % length;
+  }
+}
+
+// Play the notes of one step and remember them for their note off.
+static void play_step( t_pdarp *x )
+{
+  int i, pitch;
+
+  if ( x->mode == ARP_CHORD ) {
+    int octave = 12 * (x->step % x->octaves);
+    for ( i = 0; i < x->held; i++ ) {
+      pitch = x->sorted[i].pitch + octave;
+      if ( pitch > 127 ) continue;
+      send_note( x, pitch, x->sorted[i].velocity );
+      x->sounding[x->nsounding++] = pitch;
+    }
+  } else {
+    // the sequence is the held notes repeated one octave higher per range step
+    int index = pattern_index( x, x->step, x->held * x->octaves );
+    t_arp_note *note = (x->mode == ARP_PLAYED) ? &x->played[index % x->held] : &x->sorted[index % x->held];
+    pitch = note->pitch + 12 * (index / x->held);
+    if ( pitch <= 127 ) {
+      send_note( x, pitch, note->velocity );
+      x->sounding[x->nsounding++] = pitch;
+    }
+  }
+  outlet_float( x->x_step_out, x->step );
+}
+
+/****************************************************************/
+// Swung steps are the odd ones, delayed by a fraction of a step.
+static double step_time( t_pdarp *x, int step, double base )
+{
+  return base + ((step & 1) ? x->swing * x->period : 0);
+}
+
+static void pdarp_step_tick( t_pdarp *x )
+{
+  double now, next;
+
+  // a full gate lasts until the next step
+  clock_unset( x->x_off_clock );
+  send_note_offs( x );
+  if ( !x->held ) return;
+
+  play_step( x );
+  x->step++;
+  x->base += x->period;
+  now = clock_gettimesince( x->start );
+  next = step_time( x, x->step, x->base );
+  if ( x->gate < 1 ) clock_delay( x->x_off_clock, (next - now) * x->gate );
+  clock_delay( x->x_step_clock, next - now );
+}
+
+// The first step is only scheduled, so every note of a chord that arrives
+// in the same logical tick is held before it plays.
+static void arp_start( t_pdarp *x )
+{
+  x->start = clock_getlogicaltime();
+  x->base = 0;
+  x->step = 0;
+  x->running = 1;
+  clock_delay( x->x_step_clock, 0 );
+}
+
+static void arp_stop( t_pdarp *x )
+{
+  clock_unset( x->x_step_clock );
+  clock_unset( x->x_off_clock );
+  send_note_offs( x );
+  x->running = 0;
+}
+
+/****************************************************************/
+/// A list is <pitch> <velocity> as from [notein] or [poly]; velocity 0
+/// releases the note.  The pattern starts in the logical tick of the first
+/// held note and stops when the last one is released.
+static void pdarp_list( t_pdarp *x, t_symbol *s, int argcount, t_atom *argvec )
+{
+  int pitch, velocity;
+  if ( argcount < 2 ) {
+    post("arp error: note requires pitch and velocity.");
+    return;
+  }
+  pitch    = atom_getint( &argvec[0] );
+  velocity = atom_getint( &argvec[1] );
+  if ( pitch < 0 || pitch > 127 ) return;
+
+  if ( velocity > 0 ) {
+    hold_note( x, pitch, velocity );
+    if ( !x->running ) arp_start( x );
+  } else {
+    release_note( x, pitch );
+    if ( !x->held && x->running ) arp_stop( x );
+  }
+}
+
+//  [ bang ]  restart the pattern from its first step now
+static void pdarp_bang( t_pdarp *x )
+{
+  if ( !x->held ) return;
+  clock_unset( x->x_step_clock );
+  arp_start( x );
+}
+
+//  [ flush ]  release all held and sounding notes
+static void pdarp_flush( t_pdarp *x )
+{
+  x->held = 0;
+  arp_stop( x );
+}
+
+/****************************************************************/
+//  [ mode up|down|updown|random|played|chord ]
+static void pdarp_mode( t_pdarp *x, t_symbol *mode )
+{
+  int i;
+  for ( i = 0; i < ARP_MODES; i++ )
+    if ( !strcmp( mode->s_name, arp_mode_names[i] )) {
+      x->mode = i;
+      return;
+    }
+  post("arp: unrecognized mode %s.", mode->s_name );
+}
+
+//  [ octaves <1-4> ]  number of octaves the pattern spans
+static void pdarp_octaves( t_pdarp *x, t_floatarg n )
+{
+  int octaves = (int) n;
+  if ( octaves < 1 ) octaves = 1;
+  if ( octaves > ARP_MAX_OCTAVES ) octaves = ARP_MAX_OCTAVES;
+  x->octaves = octaves;
+}
+
+//  [ rate <ms> ]  step length, taking effect from the next step
+static void pdarp_rate( t_pdarp *x, t_floatarg ms )
+{
+  x->period = (ms < 1) ? 1 : ms;
+}
+
+//  [ tempo <bpm> [steps-per-beat] ]  same as rate, 4 steps per beat by default
+static void pdarp_tempo( t_pdarp *x, t_floatarg bpm, t_floatarg division )
+{
+  if ( bpm <= 0 ) return;
+  pdarp_rate( x, 60000.0 / (bpm * (division > 0 ? division : 4)) );
+}
+
+//  [ gate <0-1> ]  1 holds each note until the next step
+static void pdarp_gate( t_pdarp *x, t_floatarg gate )
+{
+  x->gate = (gate < 0.01f) ? 0.01f : (gate > 1) ? 1 : gate;
+}
+
+//  [ swing <0-0.9> ]  0.33 gives a triplet feel
+static void pdarp_swing( t_pdarp *x, t_floatarg swing )
+{
+  x->swing = (swing < 0) ? 0 : (swing > 0.9f) ? 0.9f : swing;
+}
+
+//  [ seed <n> ]  restart the random mode sequence
+static void pdarp_seed( t_pdarp *x, t_floatarg seed )
+{
+  x->seed = (uint32_t) seed;
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'arp' object.
+///
+///  [ arp [mode] [rate-ms] [octaves] ]
+static void *pdarp_new( t_symbol *s, int argcount, t_atom *argvec )
+{
+  t_pdarp *x = (t_pdarp *) pd_new(pdarp_class);
+
+  x->held = 0;
+  x->nsounding = 0;
+  x->mode = ARP_UP;
+  x->octaves = 1;
+  x->gate = 0.5f;
+  x->swing = 0;
+  x->period = 125;
+  x->running = 0;
+  x->step = 0;
+  x->start = 0;
+  x->base = 0;
+  x->seed = 1;
+
+  if ( argcount > 0 && argvec[0].a_type == A_SYMBOL ) {
+    pdarp_mode( x, atom_getsymbol( &argvec[0] ));
+    argcount--;
+    argvec++;
+  }
+  if ( argcount > 0 ) pdarp_rate( x, atom_getfloat( &argvec[0] ));
+  if ( argcount > 1 ) pdarp_octaves( x, atom_getfloat( &argvec[1] ));
+
+  x->x_note_out = outlet_new( &x->x_ob, &s_list );
+  x->x_step_out = outlet_new( &x->x_ob, &s_float );
+  x->x_step_clock = clock_new( x, (t_method) pdarp_step_tick );
+  x->x_off_clock = clock_new( x, (t_method) pdarp_off_tick );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Release an instance of a Pd 'arp' object.
+static void pdarp_free( t_pdarp *x )
+{
+  clock_free( x->x_step_clock );
+  clock_free( x->x_off_clock );
+  outlet_free( x->x_note_out );
+  outlet_free( x->x_step_out );
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'arp' external.
+void arp_setup(void)
+{
+  pdarp_class = class_new( gensym("arp"),
+			   (t_newmethod) pdarp_new,
+			   (t_method) pdarp_free,
+			   sizeof(t_pdarp),
+			   0,
+			   A_GIMME, 0);
+
+  class_addlist( pdarp_class, pdarp_list );
+  class_addbang( pdarp_class, pdarp_bang );
+  class_addmethod( pdarp_class, (t_method) pdarp_flush, gensym("flush"), 0 );
+  class_addmethod( pdarp_class, (t_method) pdarp_mode, gensym("mode"), A_SYMBOL, 0 );
+  class_addmethod( pdarp_class, (t_method) pdarp_octaves, gensym("octaves"), A_FLOAT, 0 );
+  class_addmethod( pdarp_class, (t_method) pdarp_rate, gensym("rate"), A_FLOAT, 0 );
+  class_addmethod( pdarp_class, (t_method) pdarp_tempo, gensym("tempo"), A_FLOAT, A_DEFFLOAT, 0 );
+  class_addmethod( pdarp_class, (t_method) pdarp_gate, gensym("gate"), A_FLOAT, 0 );
+  class_addmethod( pdarp_class, (t_method) pdarp_swing, gensym("swing"), A_FLOAT, 0 );
+  class_addmethod( pdarp_class, (t_method) pdarp_seed, gensym("seed"), A_FLOAT, 0 );
+}
+
+/****************************************************************/
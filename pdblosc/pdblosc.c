@@ -0,0 +1,287 @@
+/// pdblosc.c : Pd external for a band-limited pulse/saw/triangle unison oscillator
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+//   PolyBLEP:          V. Valimaki, A. Huovilainen, "Antialiasing oscillators
+//                      in subtractive synthesis", IEEE SPM 2007
+//   PolyBLAMP:         F. Esqueda, V. Valimaki, S. Bilbao, "Rounding corners
+//                      with BLAMP", DAFx 2016
+
+// [blosc~] replaces the phasor~ / cos~ / comparison graphs of PWMengine.pd
+// and PWMengine2.pd, and the copies of them that PWMsynth.pd makes for each
+// unison voice.  The naive waveforms are corrected with polynomial band-limited
+// steps (pulse, saw) or ramps (triangle) around each discontinuity, which
+// removes most of the audible aliasing at the cost of a few multiplies.
+//
+// Up to eight detuned unison lanes run inside the object.  Their state sits in
+// parallel arrays and the lanes form the inner loop of every sample, so the
+// compiler can evaluate four lanes per vector instruction; the lane count is
+// rounded up to a multiple of four with the extra lanes silent.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define BLOSC_LANES       8           ///< maximum unison voices
+#define BLOSC_VECTOR      4           ///< lanes per vector instruction
+
+enum { SHAPE_SAW, SHAPE_PULSE, SHAPE_TRIANGLE };
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'blosc~' object.
+typedef struct pdblosc
+{
+  t_object x_ob;           ///< standard object header
+  t_float x_f;             ///< main signal inlet scalar, frequency in Hz
+  float sr;                ///< sample rate of the DSP chain
+
+  int shape;               ///< SHAPE_SAW ...
+  int voices;              ///< unison voices in use, 1..BLOSC_LANES
+  float detune;            ///< outermost voice offset in cents
+  float spread;            ///< stereo width 0..1
+  float width;             ///< base pulse width, the second inlet adds to it
+
+  // lane state, kept in parallel arrays for the vector loop
+  float phase[BLOSC_LANES] __attribute__ ((aligned (16)));
+  float ratio[BLOSC_LANES] __attribute__ ((aligned (16)));   ///< frequency multiplier from detune
+  float gain_l[BLOSC_LANES] __attribute__ ((aligned (16)));  ///< zero for unused lanes
+  float gain_r[BLOSC_LANES] __attribute__ ((aligned (16)));
+} t_pdblosc;
+
+static t_class *pdblosc_class;
+
+/****************************************************************/
+// Two sample polynomial residuals.  t is the phase in cycles and dt the phase
+// increment per sample; both are zero away from a discontinuity.
+
+static inline float poly_blep( float t, float dt )
+{
+  if ( t < dt ) {
+    t /= dt;
+    return t + t - t * t - 1.0f;
+  }
+  if ( t > 1.0f - dt ) {
+    t = (t - 1.0f) / dt;
+    return t * t + t + t + 1.0f;
+  }
+  return 0.0f;
+}
+
+static inline float poly_blamp( float t, float dt )
+{
+  if ( t < dt ) {
+    t = t / dt - 1.0f;
+    return -t * t * t * (1.0f / 3.0f);
+  }
+  if ( t > 1.0f - dt ) {
+    t = (t - 1.0f) / dt + 1.0f;
+    return t * t * t * (1.0f / 3.0f);
+  }
+  return 0.0f;
+}
+
+/****************************************************************/
+// Render one block.  The shape argument is a constant at every call site, so
+// the compiler produces one specialized loop per waveform.
+static inline void render( t_pdblosc *x, const t_sample *freq, const t_sample *pwm,
+			   t_sample *outl, t_sample *outr, int n, const int shape )
+{
+  float *phase = x->phase, *ratio = x->ratio, *gl = x->gain_l, *gr = x->gain_r;
+  float inv_sr = 1.0f / x->sr;
+  int lanes = (x->voices + BLOSC_VECTOR - 1) & ~(BLOSC_VECTOR - 1);
+  int i, j;
+
+  for ( i = 0; i < n; i++ ) {
+    // read both inputs before writing, the outlets may share their buffers
+    float base = freq[i] * inv_sr;
+    float pw = x->width + pwm[i];
+    float l = 0, r = 0;
+
+    if ( base < 0 ) base = -base;
+    if ( pw < 0.02f ) pw = 0.02f;
+    if ( pw > 0.98f ) pw = 0.98f;
+
+    for ( j = 0; j < lanes; j++ ) {
+      float p = phase[j];
+      float dt = base * ratio[j];
+      float y, q;
+
+      if ( dt > 0.45f ) dt = 0.45f;
+      if ( shape == SHAPE_SAW ) {
+	y = 2.0f * p - 1.0f - poly_blep( p, dt );
+      } else if ( shape == SHAPE_PULSE ) {
+	// second edge at the pulse width; the naive DC offset 2pw-1 is removed
+	// so that width modulation does not move the mix
+	q = p - pw;
+	if ( q < 0 ) q += 1.0f;
+	y = (p < pw ? 1.0f : -1.0f) + poly_blep( p, dt ) - poly_blep( q, dt ) - (2.0f * pw - 1.0f);
+      } else {
+	// corners at phase 0 and one half, where the slope turns by 8 per cycle,
+	// i.e. 8 dt per sample; poly_blamp is scaled for a turn of 2, hence 4 dt
+	q = p + 0.5f;
+	if ( q >= 1.0f ) q -= 1.0f;
+	y = 1.0f - 4.0f * fabsf( p - 0.5f )
+	  + 4.0f * dt * (poly_blamp( p, dt ) - poly_blamp( q, dt ));
+      }
+      l += gl[j] * y;
+      r += gr[j] * y;
+
+      p += dt;
+      if ( p >= 1.0f ) p -= 1.0f;
+      phase[j] = p;
+    }
+    outl[i] = l;
+    outr[i] = r;
+  }
+}
+
+/****************************************************************/
+static t_int *pdblosc_perform( t_int *w )
+{
+  t_pdblosc *x = (t_pdblosc *) w[1];
+  t_sample *freq = (t_sample *) w[2];
+  t_sample *pwm  = (t_sample *) w[3];
+  t_sample *outl = (t_sample *) w[4];
+  t_sample *outr = (t_sample *) w[5];
+  int n = (int) w[6];
+
+  if ( x->shape == SHAPE_SAW )        render( x, freq, pwm, outl, outr, n, SHAPE_SAW );
+  else if ( x->shape == SHAPE_PULSE ) render( x, freq, pwm, outl, outr, n, SHAPE_PULSE );
+  else                                render( x, freq, pwm, outl, outr, n, SHAPE_TRIANGLE );
+  return w + 7;
+}
+
+static void pdblosc_dsp( t_pdblosc *x, t_signal **sp )
+{
+  x->sr = sp[0]->s_sr;
+  dsp_add( pdblosc_perform, 6, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, sp[3]->s_vec,
+	   (t_int) sp[0]->s_n );
+}
+
+/****************************************************************/
+// Lay the voices out symmetrically in pitch and pan.  Unused lanes get zero
+// gain, and the sum is scaled so that the level stays about the same.
+static void update_lanes( t_pdblosc *x )
+{
+  float norm = 1.0f / sqrtf( (float) x->voices );
+  int j;
+
+  for ( j = 0; j < BLOSC_LANES; j++ ) {
+    float pos = (x->voices > 1) ? (2.0f * j / (x->voices - 1) - 1.0f) : 0.0f;
+    float pan = pos * x->spread;
+    if ( j >= x->voices ) {
+      x->ratio[j] = 1;
+      x->gain_l[j] = x->gain_r[j] = 0;
+      continue;
+    }
+    x->ratio[j] = powf( 2.0f, pos * x->detune / 1200.0f );
+    x->gain_l[j] = norm * sqrtf( 0.5f * (1.0f - pan) );
+    x->gain_r[j] = norm * sqrtf( 0.5f * (1.0f + pan) );
+  }
+}
+
+//  [ shape saw|pulse|triangle ]
+static void pdblosc_shape( t_pdblosc *x, t_symbol *s )
+{
+  if      ( s == gensym("saw") )      x->shape = SHAPE_SAW;
+  else if ( s == gensym("pulse") )    x->shape = SHAPE_PULSE;
+  else if ( s == gensym("triangle") ) x->shape = SHAPE_TRIANGLE;
+  else post("blosc~: unknown shape %s.", s->s_name );
+}
+
+//  [ voices <1-8> ]
+static void pdblosc_voices( t_pdblosc *x, t_floatarg f )
+{
+  int n = (int) f;
+  x->voices = (n < 1) ? 1 : (n > BLOSC_LANES) ? BLOSC_LANES : n;
+  update_lanes( x );
+}
+
+//  [ detune <cents> ]  offset of the outermost voices
+static void pdblosc_detune( t_pdblosc *x, t_floatarg f )
+{
+  x->detune = (f > 0) ? f : 0;
+  update_lanes( x );
+}
+
+//  [ spread <0-1> ]  stereo width of the unison voices
+static void pdblosc_spread( t_pdblosc *x, t_floatarg f )
+{
+  x->spread = (f < 0) ? 0 : (f > 1) ? 1 : f;
+  update_lanes( x );
+}
+
+//  [ width <0-1> ]  base pulse width
+static void pdblosc_width( t_pdblosc *x, t_floatarg f )
+{
+  x->width = f;
+}
+
+//  [ reset ]  restart the lanes at fixed, staggered phases for a repeatable attack
+static void pdblosc_reset( t_pdblosc *x )
+{
+  unsigned int seed = 0x2545f491;
+  int j;
+  for ( j = 0; j < BLOSC_LANES; j++ ) {
+    seed = seed * 1664525u + 1013904223u;
+    x->phase[j] = j ? (seed >> 8) * (1.0f / 16777216.0f) : 0.0f;
+  }
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'blosc~' object.
+///
+///  [ blosc~ [saw|pulse|triangle] [voices] ]
+///  inlets: frequency in Hz (signal), pulse width modulation (signal)
+///  outlets: left, right
+static void *pdblosc_new( t_symbol *shape, t_floatarg voices )
+{
+  t_pdblosc *x = (t_pdblosc *) pd_new(pdblosc_class);
+
+  x->x_f = 0;
+  x->sr = sys_getsr();
+  x->shape = SHAPE_SAW;
+  if ( shape && *shape->s_name ) pdblosc_shape( x, shape );
+  x->detune = 15;
+  x->spread = 0.5f;
+  x->width = 0.5f;
+  pdblosc_voices( x, voices > 0 ? voices : 1 );
+  pdblosc_reset( x );
+
+  inlet_new( &x->x_ob, &x->x_ob.ob_pd, &s_signal, &s_signal );
+  outlet_new( &x->x_ob, &s_signal );
+  outlet_new( &x->x_ob, &s_signal );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'blosc~' external.
+void blosc_tilde_setup(void)
+{
+  pdblosc_class = class_new( gensym("blosc~"),
+			     (t_newmethod) pdblosc_new,
+			     0,
+			     sizeof(t_pdblosc),
+			     0,
+			     A_DEFSYMBOL, A_DEFFLOAT, 0);
+
+  CLASS_MAINSIGNALIN( pdblosc_class, t_pdblosc, x_f );
+  class_addmethod( pdblosc_class, (t_method) pdblosc_dsp, gensym("dsp"), A_CANT, 0 );
+  class_addmethod( pdblosc_class, (t_method) pdblosc_shape, gensym("shape"), A_SYMBOL, 0 );
+  class_addmethod( pdblosc_class, (t_method) pdblosc_voices, gensym("voices"), A_FLOAT, 0 );
+  class_addmethod( pdblosc_class, (t_method) pdblosc_detune, gensym("detune"), A_FLOAT, 0 );
+  class_addmethod( pdblosc_class, (t_method) pdblosc_spread, gensym("spread"), A_FLOAT, 0 );
+  class_addmethod( pdblosc_class, (t_method) pdblosc_width, gensym("width"), A_FLOAT, 0 );
+  class_addmethod( pdblosc_class, (t_method) pdblosc_reset, gensym("reset"), 0 );
+}
+
+/****************************************************************/
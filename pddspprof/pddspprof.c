@@ -0,0 +1,319 @@
+/// pddspprof.c : Pd external timing the DSP chain of a subpatch per block
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+//   clock_gettime:     http://man7.org/linux/man-pages/man2/clock_gettime.2.html
+
+// load-meter.pd samples Pd's global [cputime] once a second, which cannot
+// say which voice or oscillator is expensive.  [dspprof~] is used in pairs
+// with the same name around the chain to be measured:
+//
+//   [inlet~]
+//   |
+//   [dspprof~ osc-$0 begin]
+//   |
+//   ... the chain to be timed ...
+//   |
+//   [dspprof~ osc-$0 end]
+//   |
+//   [outlet~]
+//
+// Both pass their signal through unchanged.  The signal connections make Pd
+// schedule the begin object before the chain and the end object after it;
+// objects with no signal path from the begin object (an [osc~] with only a
+// control inlet, say) may be scheduled earlier, so feed them from it, for
+// example through a [*~ 0] into an unused signal inlet.
+//
+// The end object reads CLOCK_MONOTONIC and updates a statistics entry for
+// the name: count, min, sum and max, plus a histogram with eight buckets per
+// octave from which the 99th percentile is estimated.  The entries live in
+// one table shared by all instances, each guarded by a sequence counter, so
+// the report never blocks the DSP routine.  Using $0 in the name gives every
+// abstraction instance its own entry; a shared name adds them together.
+//
+// A single [dspprof~ <name> tick] instead times the interval between two
+// consecutive DSP ticks.  Running live this is just the block period plus
+// scheduling jitter, but in Pd's -batch mode, where ticks run back to back,
+// it is the cost of the whole DSP graph per block.
+//
+// Any [dspprof~] object answers [report( with a table sorted by mean time,
+// posted to the Pd window and sent to its right outlet one list per entry:
+//   <name> <blocks> <min-us> <mean-us> <max-us> <p99-us> <percent-of-block>
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define PROF_MAX_ENTRIES    128
+#define PROF_BUCKETS        256       ///< eight per octave up to 2^32 ns
+
+/****************************************************************/
+/// Statistics for one profiled chain.  Only the DSP routine writes the
+/// timing fields, between two increments of seq.
+typedef struct prof_entry
+{
+  t_symbol *name;
+  uint32_t seq;                    ///< seqlock counter, odd while being written
+  uint64_t start;                  ///< ns timestamp taken by the begin object
+  uint64_t count;                  ///< blocks timed
+  uint64_t sum;                    ///< total ns
+  uint32_t min, max;               ///< ns
+  float block_ns;                  ///< length of one DSP block in ns
+  uint32_t hist[PROF_BUCKETS];
+} t_prof_entry;
+
+static t_prof_entry prof_table[PROF_MAX_ENTRIES];
+static int prof_count;
+
+enum { PROF_BEGIN, PROF_END, PROF_TICK };
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'dspprof~' object.
+typedef struct pddspprof
+{
+  t_object x_ob;           ///< standard object header
+  t_float x_f;             ///< main signal inlet scalar
+  t_outlet *x_report;      ///< report lists
+  int role;                ///< PROF_BEGIN, PROF_END or PROF_TICK
+  t_prof_entry *entry;     ///< shared with the other object of the pair
+} t_pddspprof;
+
+static t_class *pddspprof_class;
+
+/****************************************************************/
+static inline uint64_t now_ns( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Bucket of a duration: the octave in the high bits and the next three
+// mantissa bits below it.
+static inline int bucket_of( uint32_t ns )
+{
+  int msb;
+  if ( ns < 8 ) return ns;
+  msb = 31 - __builtin_clz( ns );
+  return (msb << 3) | ((ns >> (msb - 3)) & 7);
+}
+
+// Lower bound of a bucket in ns.
+static inline double bucket_floor( int b )
+{
+  if ( b < 8 ) return b;
+  return ldexp( 8 | (b & 7), (b >> 3) - 3 );
+}
+
+/****************************************************************/
+// Find the entry for a name, claiming a new one if needed.  Only called from
+// object creation, in the Pd thread.
+static t_prof_entry *find_entry( t_symbol *name )
+{
+  t_prof_entry *e;
+  int i;
+  for ( i = 0; i < prof_count; i++ )
+    if ( prof_table[i].name == name ) return &prof_table[i];
+  if ( prof_count >= PROF_MAX_ENTRIES ) {
+    post("dspprof~: table full, %s is not profiled.", name->s_name );
+    return NULL;
+  }
+  e = &prof_table[prof_count];
+  memset( e, 0, sizeof(*e) );
+  e->min = UINT32_MAX;
+  e->name = name;
+  // publish the entry after it is initialized
+  __atomic_store_n( &prof_count, prof_count + 1, __ATOMIC_RELEASE );
+  return e;
+}
+
+/****************************************************************/
+static t_int *pddspprof_perform( t_int *w )
+{
+  t_pddspprof *x = (t_pddspprof *) w[1];
+  t_sample *in  = (t_sample *) w[2];
+  t_sample *out = (t_sample *) w[3];
+  int n = (int) w[4];
+  t_prof_entry *e = x->entry;
+
+  if ( in != out ) memcpy( out, in, n * sizeof(t_sample) );
+  if ( !e ) return w + 5;
+
+  if ( x->role == PROF_BEGIN ) {
+    e->start = now_ns();
+  } else if ( e->start ) {
+    uint64_t t = now_ns(), elapsed = t - e->start;
+    uint32_t ns = (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t) elapsed;
+
+    __atomic_store_n( &e->seq, e->seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    e->count++;
+    e->sum += ns;
+    if ( ns < e->min ) e->min = ns;
+    if ( ns > e->max ) e->max = ns;
+    e->hist[bucket_of( ns )]++;
+    __atomic_store_n( &e->seq, e->seq + 1, __ATOMIC_RELEASE );
+    e->start = (x->role == PROF_TICK) ? t : 0;
+  } else if ( x->role == PROF_TICK ) {
+    e->start = now_ns();
+  }
+  return w + 5;
+}
+
+static void pddspprof_dsp( t_pddspprof *x, t_signal **sp )
+{
+  if ( x->entry ) x->entry->block_ns = 1e9f * sp[0]->s_n / sp[0]->s_sr;
+  dsp_add( pddspprof_perform, 4, x, sp[0]->s_vec, sp[1]->s_vec, (t_int) sp[0]->s_n );
+}
+
+/****************************************************************/
+/// One row of the report, read consistently from a live entry.
+typedef struct prof_row
+{
+  t_symbol *name;
+  double count, min, mean, max, p99, load;
+} t_prof_row;
+
+static void read_row( t_prof_entry *e, t_prof_row *row )
+{
+  static uint32_t hist[PROF_BUCKETS];
+  uint64_t count, sum, seen = 0, rank;
+  uint32_t min, max, before, after;
+  float block_ns;
+  int b;
+
+  do {
+    before = __atomic_load_n( &e->seq, __ATOMIC_ACQUIRE );
+    count = e->count;
+    sum = e->sum;
+    min = e->min;
+    max = e->max;
+    block_ns = e->block_ns;
+    memcpy( hist, e->hist, sizeof(hist) );
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    after = __atomic_load_n( &e->seq, __ATOMIC_RELAXED );
+  } while ( (before & 1) || before != after );
+
+  row->name = e->name;
+  row->count = count;
+  if ( !count ) {
+    row->min = row->mean = row->max = row->p99 = row->load = 0;
+    return;
+  }
+  row->min = min * 1e-3;
+  row->max = max * 1e-3;
+  row->mean = (double) sum / count * 1e-3;
+  row->load = (block_ns > 0) ? 100.0 * sum / count / block_ns : 0;
+
+  // the upper edge of the first bucket which reaches 99 percent of the blocks
+  rank = count - count / 100;
+  for ( b = 0; b < PROF_BUCKETS; b++ ) {
+    seen += hist[b];
+    if ( seen >= rank ) break;
+  }
+  row->p99 = bucket_floor( b + 1 ) * 1e-3;
+  if ( row->p99 > row->max ) row->p99 = row->max;
+}
+
+static int compare_rows( const void *a, const void *b )
+{
+  double ma = ((const t_prof_row *) a)->mean, mb = ((const t_prof_row *) b)->mean;
+  return (ma < mb) - (ma > mb);
+}
+
+/****************************************************************/
+//  [ report ]  post every entry sorted by mean time, and send each to the outlet
+static void pddspprof_report( t_pddspprof *x )
+{
+  static t_prof_row rows[PROF_MAX_ENTRIES];
+  int count = __atomic_load_n( &prof_count, __ATOMIC_ACQUIRE );
+  int i;
+
+  for ( i = 0; i < count; i++ ) read_row( &prof_table[i], &rows[i] );
+  qsort( rows, count, sizeof(t_prof_row), compare_rows );
+
+  post("dspprof~: %-24s %8s %9s %9s %9s %9s %7s", "name", "blocks", "min-us", "mean-us", "max-us", "p99-us", "block%");
+  for ( i = 0; i < count; i++ ) {
+    t_atom a[7];
+    post("dspprof~: %-24s %8.0f %9.2f %9.2f %9.2f %9.2f %7.2f", rows[i].name->s_name,
+	 rows[i].count, rows[i].min, rows[i].mean, rows[i].max, rows[i].p99, rows[i].load );
+    SETSYMBOL( &a[0], rows[i].name );
+    SETFLOAT( &a[1], rows[i].count );
+    SETFLOAT( &a[2], rows[i].min );
+    SETFLOAT( &a[3], rows[i].mean );
+    SETFLOAT( &a[4], rows[i].max );
+    SETFLOAT( &a[5], rows[i].p99 );
+    SETFLOAT( &a[6], rows[i].load );
+    outlet_list( x->x_report, &s_list, 7, a );
+  }
+}
+
+//  [ reset ]  clear the statistics of every entry, e.g. after loading patches
+static void pddspprof_reset( t_pddspprof *x )
+{
+  int count = __atomic_load_n( &prof_count, __ATOMIC_ACQUIRE );
+  int i;
+  for ( i = 0; i < count; i++ ) {
+    t_prof_entry *e = &prof_table[i];
+    __atomic_store_n( &e->seq, e->seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    e->count = e->sum = 0;
+    e->min = UINT32_MAX;
+    e->max = 0;
+    memset( e->hist, 0, sizeof(e->hist) );
+    __atomic_store_n( &e->seq, e->seq + 1, __ATOMIC_RELEASE );
+  }
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'dspprof~' object.
+///
+///  [ dspprof~ <name> begin|end|tick ]
+static void *pddspprof_new( t_symbol *name, t_symbol *role )
+{
+  t_pddspprof *x = (t_pddspprof *) pd_new(pddspprof_class);
+
+  x->x_f = 0;
+  if      ( role == gensym("end") )  x->role = PROF_END;
+  else if ( role == gensym("tick") ) x->role = PROF_TICK;
+  else {
+    x->role = PROF_BEGIN;
+    if ( role != gensym("begin") )
+      post("dspprof~: expected begin, end or tick after the name, using begin.");
+  }
+  x->entry = (name && *name->s_name) ? find_entry( name ) : NULL;
+
+  outlet_new( &x->x_ob, &s_signal );
+  x->x_report = outlet_new( &x->x_ob, &s_list );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'dspprof~' external.
+void dspprof_tilde_setup(void)
+{
+  pddspprof_class = class_new( gensym("dspprof~"),
+			       (t_newmethod) pddspprof_new,
+			       0,
+			       sizeof(t_pddspprof),
+			       0,
+			       A_DEFSYMBOL, A_DEFSYMBOL, 0);
+
+  CLASS_MAINSIGNALIN( pddspprof_class, t_pddspprof, x_f );
+  class_addmethod( pddspprof_class, (t_method) pddspprof_dsp, gensym("dsp"), A_CANT, 0 );
+  class_addmethod( pddspprof_class, (t_method) pddspprof_report, gensym("report"), 0 );
+  class_addmethod( pddspprof_class, (t_method) pddspprof_reset, gensym("reset"), 0 );
+}
+
+/****************************************************************/
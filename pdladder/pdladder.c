@@ -0,0 +1,313 @@
+/// pdladder.c : Pd external for a resonant ladder / state-variable filter voice
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+//   Ladder model:      A. Huovilainen, "Non-linear digital implementation of
+//                      the Moog ladder filter", DAFx 2004
+//   TPT SVF:           V. Zavalishin, "The Art of VA Filter Design"
+
+// [ladder~] replaces the [vcf~] voices of the 101/303 sequencers together
+// with the control rate cutoff chains of 6stageFilter.pd.  The cutoff
+// envelope, accent and key tracking are computed per sample inside the
+// object, so a sweep is smooth no matter how few messages drive it.
+//
+// Each block is processed in two passes: the first fills a cutoff vector
+// from the envelope, key tracking and the modulation inlet, the second runs
+// the filter over it.  The ladder runs 2x oversampled with a saturating
+// input stage; the state-variable modes run at the base rate.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define LADDER_MAX_BLOCK  1024        ///< larger blocks are processed in pieces
+
+enum { MODE_LADDER, MODE_LOWPASS, MODE_BANDPASS, MODE_HIGHPASS, MODE_NOTCH };
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'ladder~' object.
+typedef struct pdladder
+{
+  t_object x_ob;           ///< standard object header
+  t_float x_f;             ///< main signal inlet scalar
+  float sr;                ///< sample rate of the DSP chain
+
+  int mode;                ///< MODE_LADDER ...
+  float cutoff;            ///< base cutoff in Hz
+  float reso;              ///< resonance 0..1, the ladder self-oscillates near 1
+  float drive;             ///< input gain into the saturating stage
+  float envmod;            ///< envelope depth in octaves
+  float keytrack;          ///< 1 tracks the keyboard fully, 0 not at all
+  float accent_amount;     ///< extra envelope depth and resonance on accented notes
+
+  // envelope, advanced per sample
+  float env;
+  int attacking;
+  float attack_step;       ///< linear rise per sample
+  float decay_coef;        ///< exponential fall per sample
+  float accent;            ///< accent of the current note, 0..1
+  float key_oct;           ///< key tracking offset of the current note in octaves
+
+  // filter state
+  float s[4];              ///< ladder stages
+  float last_in;           ///< previous input for the oversampled ladder
+  float ic1, ic2;          ///< SVF integrator states
+
+  float cut[LADDER_MAX_BLOCK];   ///< per sample cutoff for the current block
+} t_pdladder;
+
+static t_class *pdladder_class;
+
+/****************************************************************/
+// Cheap approximations, accurate enough for audio control paths.
+
+static inline float fast_exp2( float x )
+{
+  // split into integer and fraction, polynomial for 2^f on [0,1)
+  float fi = floorf( x ), f = x - fi;
+  float p = 1.0f + f * (0.6960656f + f * (0.2244418f + f * 0.0794402f));
+  return ldexpf( p, (int) fi );
+}
+
+static inline float fast_tanh( float x )
+{
+  if ( x > 3.0f ) return 1.0f;
+  if ( x < -3.0f ) return -1.0f;
+  return x * (27.0f + x * x) / (27.0f + 9.0f * x * x);
+}
+
+/****************************************************************/
+// First pass: cutoff for every sample of the block.
+static void compute_cutoff( t_pdladder *x, const t_sample *mod, int n, float nyquist )
+{
+  float env = x->env;
+  float depth = x->envmod * (1.0f + x->accent * x->accent_amount);
+  float base = x->keytrack * x->key_oct;
+  int i;
+
+  for ( i = 0; i < n; i++ ) {
+    float hz;
+    if ( x->attacking ) {
+      env += x->attack_step;
+      if ( env >= 1.0f ) {
+	env = 1.0f;
+	x->attacking = 0;
+      }
+    } else {
+      env *= x->decay_coef;
+    }
+    hz = x->cutoff * fast_exp2( base + depth * env + mod[i] );
+    if ( hz < 10.0f ) hz = 10.0f;
+    if ( hz > nyquist ) hz = nyquist;
+    x->cut[i] = hz;
+  }
+  x->env = env;
+}
+
+/****************************************************************/
+// Second pass for the ladder: four one-pole stages with tanh saturation on the
+// input and the resonance feedback, run twice per sample.
+static void run_ladder( t_pdladder *x, const t_sample *in, t_sample *out, int n, float sr )
+{
+  float s0 = x->s[0], s1 = x->s[1], s2 = x->s[2], s3 = x->s[3];
+  float last = x->last_in;
+  float k = 4.0f * (x->reso + x->accent * x->accent_amount * 0.15f);
+  float w_scale = (float) M_PI / sr;     // 2 pi f / (2 sr)
+  float comp = 1.0f + 0.5f * k;         // keeps the passband level as resonance rises
+  int i, pass;
+
+  for ( i = 0; i < n; i++ ) {
+    float wc = x->cut[i] * w_scale;
+    float g = wc / (1.0f + wc);
+    float xin = in[i] * x->drive, acc = 0;
+
+    for ( pass = 0; pass < 2; pass++ ) {
+      float u = pass ? xin : 0.5f * (last + xin);
+      u = fast_tanh( u * comp - k * s3 );
+      s0 += g * (u - fast_tanh( s0 ));
+      s1 += g * (s0 - s1);
+      s2 += g * (s1 - s2);
+      s3 += g * (s2 - s3);
+      acc += s3;
+    }
+    last = xin;
+    out[i] = 0.5f * acc;
+  }
+  x->s[0] = s0; x->s[1] = s1; x->s[2] = s2; x->s[3] = s3;
+  x->last_in = last;
+}
+
+/****************************************************************/
+// Second pass for the state-variable modes (topology preserving transform).
+static void run_svf( t_pdladder *x, const t_sample *in, t_sample *out, int n, float sr )
+{
+  float ic1 = x->ic1, ic2 = x->ic2;
+  float r = x->reso + x->accent * x->accent_amount * 0.15f;
+  float k = 2.0f - 1.98f * (r > 1.0f ? 1.0f : r);
+  float w_scale = (float) M_PI / sr;
+  int mode = x->mode, i;
+
+  for ( i = 0; i < n; i++ ) {
+    float w = x->cut[i] * w_scale;
+    // Pade approximation of tan(w), good to a few percent below 0.45 sr
+    float g = w * (15.0f - w * w) / (15.0f - 6.0f * w * w);
+    float v = fast_tanh( in[i] * x->drive );
+    float hp = (v - (g + k) * ic1 - ic2) / (1.0f + g * (g + k));
+    float bp = g * hp + ic1;
+    float lp = g * bp + ic2;
+    ic1 = g * hp + bp;
+    ic2 = g * bp + lp;
+
+    switch ( mode ) {
+    case MODE_BANDPASS: out[i] = bp; break;
+    case MODE_HIGHPASS: out[i] = hp; break;
+    case MODE_NOTCH:    out[i] = lp + hp; break;
+    default:            out[i] = lp; break;
+    }
+  }
+  x->ic1 = ic1;
+  x->ic2 = ic2;
+}
+
+/****************************************************************/
+static t_int *pdladder_perform( t_int *w )
+{
+  t_pdladder *x = (t_pdladder *) w[1];
+  t_sample *in  = (t_sample *) w[2];
+  t_sample *mod = (t_sample *) w[3];
+  t_sample *out = (t_sample *) w[4];
+  int n = (int) w[5];
+  float sr = x->sr;
+
+  while ( n > 0 ) {
+    int chunk = (n > LADDER_MAX_BLOCK) ? LADDER_MAX_BLOCK : n;
+    compute_cutoff( x, mod, chunk, 0.45f * sr );
+    if ( x->mode == MODE_LADDER ) run_ladder( x, in, out, chunk, sr );
+    else run_svf( x, in, out, chunk, sr );
+    in += chunk; mod += chunk; out += chunk; n -= chunk;
+  }
+  return w + 6;
+}
+
+static void pdladder_dsp( t_pdladder *x, t_signal **sp )
+{
+  x->sr = sp[0]->s_sr;
+  dsp_add( pdladder_perform, 5, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, (t_int) sp[0]->s_n );
+}
+
+/****************************************************************/
+//  [ note <pitch> [velocity] ]  restart the envelope; velocity 100 and up
+//  counts as an accent, like the accent step of the sequencers
+static void pdladder_note( t_pdladder *x, t_floatarg pitch, t_floatarg velocity )
+{
+  x->key_oct = (pitch - 60.0f) / 12.0f;
+  x->accent = (velocity >= 100) ? 1.0f : 0.0f;
+  x->attacking = 1;
+}
+
+static void pdladder_cutoff( t_pdladder *x, t_floatarg f ) { x->cutoff = (f > 10) ? f : 10; }
+static void pdladder_reso( t_pdladder *x, t_floatarg f )   { x->reso = (f < 0) ? 0 : (f > 1.2f) ? 1.2f : f; }
+static void pdladder_drive( t_pdladder *x, t_floatarg f )  { x->drive = (f > 0) ? f : 0; }
+static void pdladder_envmod( t_pdladder *x, t_floatarg f ) { x->envmod = f; }
+static void pdladder_keytrack( t_pdladder *x, t_floatarg f ) { x->keytrack = f; }
+static void pdladder_accent( t_pdladder *x, t_floatarg f ) { x->accent_amount = (f > 0) ? f : 0; }
+
+//  [ attack <ms> ]
+static void pdladder_attack( t_pdladder *x, t_floatarg ms )
+{
+  float samples = (ms > 0 ? ms : 0.1f) * 0.001f * sys_getsr();
+  x->attack_step = 1.0f / (samples > 1 ? samples : 1);
+}
+
+//  [ decay <ms> ]  time to fall to about a third
+static void pdladder_decay( t_pdladder *x, t_floatarg ms )
+{
+  float samples = (ms > 1 ? ms : 1) * 0.001f * sys_getsr();
+  x->decay_coef = expf( -1.0f / samples );
+}
+
+//  [ mode ladder|lowpass|bandpass|highpass|notch ]
+static void pdladder_mode( t_pdladder *x, t_symbol *s )
+{
+  if      ( s == gensym("ladder") )   x->mode = MODE_LADDER;
+  else if ( s == gensym("lowpass") )  x->mode = MODE_LOWPASS;
+  else if ( s == gensym("bandpass") ) x->mode = MODE_BANDPASS;
+  else if ( s == gensym("highpass") ) x->mode = MODE_HIGHPASS;
+  else if ( s == gensym("notch") )    x->mode = MODE_NOTCH;
+  else post("ladder~: unknown mode %s.", s->s_name );
+}
+
+//  [ clear ]  reset the filter state after it blew up or to cut a tail
+static void pdladder_clear( t_pdladder *x )
+{
+  memset( x->s, 0, sizeof(x->s) );
+  x->last_in = x->ic1 = x->ic2 = 0;
+  x->env = 0;
+  x->attacking = 0;
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'ladder~' object.
+///
+///  [ ladder~ [cutoff-hz] [resonance] ]
+///  inlets: audio, cutoff modulation in octaves (signal)
+static void *pdladder_new( t_floatarg cutoff, t_floatarg reso )
+{
+  t_pdladder *x = (t_pdladder *) pd_new(pdladder_class);
+
+  x->x_f = 0;
+  x->sr = sys_getsr();
+  x->mode = MODE_LADDER;
+  pdladder_cutoff( x, cutoff > 0 ? cutoff : 1000 );
+  pdladder_reso( x, reso );
+  x->drive = 1;
+  x->envmod = 0;
+  x->keytrack = 0;
+  x->accent_amount = 0.5f;
+  x->accent = 0;
+  x->key_oct = 0;
+  pdladder_attack( x, 3 );
+  pdladder_decay( x, 200 );
+  pdladder_clear( x );
+
+  inlet_new( &x->x_ob, &x->x_ob.ob_pd, &s_signal, &s_signal );
+  outlet_new( &x->x_ob, &s_signal );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'ladder~' external.
+void ladder_tilde_setup(void)
+{
+  pdladder_class = class_new( gensym("ladder~"),
+			      (t_newmethod) pdladder_new,
+			      0,
+			      sizeof(t_pdladder),
+			      0,
+			      A_DEFFLOAT, A_DEFFLOAT, 0);
+
+  CLASS_MAINSIGNALIN( pdladder_class, t_pdladder, x_f );
+  class_addmethod( pdladder_class, (t_method) pdladder_dsp, gensym("dsp"), A_CANT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_note, gensym("note"), A_FLOAT, A_DEFFLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_cutoff, gensym("cutoff"), A_FLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_reso, gensym("reso"), A_FLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_drive, gensym("drive"), A_FLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_envmod, gensym("envmod"), A_FLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_keytrack, gensym("keytrack"), A_FLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_accent, gensym("accent"), A_FLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_attack, gensym("attack"), A_FLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_decay, gensym("decay"), A_FLOAT, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_mode, gensym("mode"), A_SYMBOL, 0 );
+  class_addmethod( pdladder_class, (t_method) pdladder_clear, gensym("clear"), 0 );
+}
+
+/****************************************************************/
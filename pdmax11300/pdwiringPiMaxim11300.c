@@ -10,6 +10,7 @@
 
 /****************************************************************/ 
 // import standard libc API
+#define _GNU_SOURCE             // asprintf, SCHED_IDLE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +21,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
+#include <pthread.h>
 #include <wiringPi.h>
 
 
@@ -262,6 +265,9 @@ uint16_t readx = 0;
 // Import the wiringPi API.
 #include <wiringPi.h>
 #include <wiringPiSPI.h>
+#include <lcd.h>
+
+#include "spitrace.h"
 
 
 
@@ -271,6 +277,18 @@ uint16_t readx = 0;
 /// wiringPi object.
 static int sys_mode = 0;        ///< flag to indicate initialization with wiringPiSetupSys
 
+/// The SPI transfer buffers are shared, so every register access holds this
+/// lock; the CV glide thread writes the DAC concurrently with Pd.
+static pthread_mutex_t spi_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define SPI_CHANNELS 2
+#define PIXI_PORTS   20
+#define DAC_MAX_CODE 4095
+
+/// Last code written to each DAC port plus one, or 0 if never written; the
+/// telemetry poller reads the ports back and compares.
+static int dac_shadow[SPI_CHANNELS][PIXI_PORTS];
+
 /****************************************************************/ 
 /// Data structure to hold the state of a single Pd 'wiringPi' object.
 typedef struct pdwiringPi
@@ -289,6 +307,16 @@ typedef struct pdwiringPi
   int value;              ///< spi value
   int spichan;              ///< spi chan
 
+  int dac_spi;             ///< SPI channel of a port-specific DAC instance
+  int dac_port;            ///< a non-negative DAC port if initialized to control a single port
+  float dac_scale;         ///< DAC codes per input unit, resolved at creation
+  float dac_offset;        ///< DAC code for an input of zero
+
+  t_clock *telemetry_clock;    ///< publishes the telemetry snapshot, if this object started it
+  float telemetry_limit;       ///< temperature alarm threshold in degrees C
+  int telemetry_alarm;         ///< alarm bits last published
+  unsigned int telemetry_seen; ///< mismatch count last published
+
 
 
 char* text ;
@@ -301,6 +329,10 @@ char* text ;
 
 static t_class *pdwiringPi_class;
 
+// The DAC write and CV glide routines are defined further below.
+void WriteAnalog(uint8_t spichannel, uint8_t channel, uint16_t value);
+static int cv_set_target( int chan, int port, int value );
+
 /****************************************************************/
 // Utility functions.
 static int atom_matches( t_atom *atom, char *symbol )
@@ -309,10 +341,13 @@ static int atom_matches( t_atom *atom, char *symbol )
 	   && !strcmp( atom->a_w.w_symbol->s_name, symbol ) );
 }
 
-static inline int symbol_matches( t_symbol *sym, char *symbol )
-{
-  return !strcmp( sym->s_name, symbol );
-}
+/// Message selectors are interned once in wiringPi_setup so that
+/// pdwiringPi_eval dispatches on pointer comparisons.
+static t_symbol *sym_digitalRead, *sym_digitalWrite, *sym_pwmWrite, *sym_pinMode;
+static t_symbol *sym_wpiPinToGpio, *sym_physPinToGpio, *sym_piBoardRev, *sym_load_spi_driver;
+static t_symbol *sym_spi_init, *sym_spi_write, *sym_spi_glide, *sym_spi_slew, *sym_cv_rate;
+static t_symbol *sym_lcd, *sym_lcd_clear, *sym_lcd_init, *sym_lcd_rate, *sym_lcd_close;
+static t_symbol *sym_telemetry, *sym_spi_trace, *sym_reboot;
 
 
 
@@ -353,9 +388,20 @@ static void pdwiringPi_bang( t_pdwiringPi *x )
 
 
 /****************************************************************/
-// A float is always interpreted as a type of write for pin-specific instances.
+// A float is always interpreted as a type of write for pin-specific and
+// port-specific instances.
 static void pdwiringPi_float( t_pdwiringPi *x, float value )
 {
+  // if a port-specific DAC instance, the scaling was resolved at creation
+  if ( x->dac_port >= 0 ) {
+    int code = (int) (value * x->dac_scale + x->dac_offset + 0.5f);
+    if (code < 0) code = 0;
+    if (code > DAC_MAX_CODE) code = DAC_MAX_CODE;
+    if ( !cv_set_target( x->dac_spi, x->dac_port, code ))
+      WriteAnalog( x->dac_spi, x->dac_port, code );
+    return;
+  }
+
   // if a pin-specific instance
   if ( x->pin >= 0 ) {
 
@@ -415,14 +461,168 @@ static void set_pin_mode( int pin, int mode )
 
 
 
+/****************************************************************/
+/// SPI trace.  While tracing, every register access appends a record to a
+/// preallocated ring.  Accesses hold spi_lock, so there is one writer at a
+/// time; a background thread drains the ring into the trace file so the bus
+/// never waits for the disk.  When the ring is full new records are dropped
+/// and counted instead.  The file format is in spitrace.h.
+#define SPITRACE_RING 65536      // records, must be a power of two
+
+static spitrace_record *spitrace_ring = NULL;
+static volatile int spitrace_enabled = 0;
+static uint32_t spitrace_head = 0;      ///< records written, advanced under spi_lock
+static uint32_t spitrace_tail = 0;      ///< records flushed, advanced by the flush thread
+static uint32_t spitrace_dropped = 0;   ///< records lost to a full ring
+static FILE *spitrace_file = NULL;
+static pthread_t spitrace_thread;
+
+static inline uint64_t spitrace_now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/****************************************************************/
+// Append one record for a transfer which started at t0.  Called with
+// spi_lock held.
+static inline void spitrace_add( uint8_t spichannel, uint8_t address, uint8_t flags, uint16_t value, uint64_t t0 )
+{
+  uint32_t head = spitrace_head;
+  spitrace_record *r;
+
+  if ( head - __atomic_load_n( &spitrace_tail, __ATOMIC_ACQUIRE ) >= SPITRACE_RING ) {
+    spitrace_dropped++;
+    return;
+  }
+  r = &spitrace_ring[head & (SPITRACE_RING - 1)];
+  r->t_ns = t0;
+  r->duration_ns = (uint32_t) (spitrace_now() - t0);
+  r->spichannel = spichannel;
+  r->address = address;
+  r->flags = flags;
+  r->reserved = 0;
+  r->value = value;
+  r->reserved2 = 0;
+  __atomic_store_n( &spitrace_head, head + 1, __ATOMIC_RELEASE );
+}
+
+/****************************************************************/
+// Write everything recorded so far, in at most two contiguous pieces.
+static void spitrace_drain( void )
+{
+  uint32_t head = __atomic_load_n( &spitrace_head, __ATOMIC_ACQUIRE );
+  uint32_t tail = spitrace_tail;
+
+  while ( tail != head ) {
+    uint32_t start = tail & (SPITRACE_RING - 1);
+    uint32_t count = head - tail;
+    if ( count > SPITRACE_RING - start ) count = SPITRACE_RING - start;
+    fwrite( &spitrace_ring[start], sizeof(spitrace_record), count, spitrace_file );
+    tail += count;
+    __atomic_store_n( &spitrace_tail, tail, __ATOMIC_RELEASE );
+  }
+}
+
+static void *spitrace_flush( void *arg )
+{
+  struct timespec pause = { 0, 50000000 };    // 50 ms, a quarter of the ring at 300k transfers per second
+  (void) arg;
+  while ( spitrace_enabled ) {
+    spitrace_drain();
+    nanosleep( &pause, NULL );
+  }
+  spitrace_drain();
+  fflush( spitrace_file );
+  return NULL;
+}
+
+/****************************************************************/
+static void spitrace_stop( void )
+{
+  if ( !spitrace_file ) return;
+  // no transfer can be half recorded once the lock is held
+  pthread_mutex_lock( &spi_lock );
+  spitrace_enabled = 0;
+  pthread_mutex_unlock( &spi_lock );
+  pthread_join( spitrace_thread, NULL );
+  fclose( spitrace_file );
+  spitrace_file = NULL;
+  post("wiringPi: spi trace stopped, %u transfers recorded, %u dropped.", spitrace_head, spitrace_dropped );
+}
+
+static void spitrace_start( const char *path )
+{
+  spitrace_header header;
+
+  spitrace_stop();
+  if ( !spitrace_ring ) spitrace_ring = (spitrace_record *) getbytes( SPITRACE_RING * sizeof(spitrace_record) );
+  if ( !(spitrace_file = fopen( path, "wb" ))) {
+    post("wiringPi error: unable to open spi trace file %s, error %d.", path, errno );
+    return;
+  }
+  header.magic = SPITRACE_MAGIC;
+  header.version = SPITRACE_VERSION;
+  header.record_size = sizeof(spitrace_record);
+  header.start_ns = spitrace_now();
+  fwrite( &header, sizeof(header), 1, spitrace_file );
+
+  pthread_mutex_lock( &spi_lock );
+  spitrace_head = spitrace_tail = spitrace_dropped = 0;
+  spitrace_enabled = 1;
+  pthread_mutex_unlock( &spi_lock );
+
+  if ( pthread_create( &spitrace_thread, NULL, spitrace_flush, NULL )) {
+    post("wiringPi: unable to start spi trace thread.");
+    spitrace_enabled = 0;
+    fclose( spitrace_file );
+    spitrace_file = NULL;
+    return;
+  }
+  post("wiringPi: tracing spi transfers to %s.", path );
+}
+
+
+
+
+
+
+
+
+
+
 /****************************************************************/
 void WriteRegister(uint8_t spichannel , uint8_t address, uint16_t value)
 {
+	uint64_t t0;
+	pthread_mutex_lock( &spi_lock );
+	t0 = spitrace_enabled ? spitrace_now() : 0;
 	txbuf[0] = ( (address) << 1) | PIXI_WRITE; //write
 	txbuf[1] = (value) >> 8; //value H
 	txbuf[2] = (value) & 0xFF; //valueL
 		//post("wiringPi: writereg spichan %d address %d value %d buf[0] %d buf[1] %d buf[2] %d",spichannel, address, value, txbuf[0],txbuf[1],txbuf[2]);
 	wiringPiSPIDataRW (spichannel, txbuf, 3);
+	if (t0) spitrace_add( spichannel, address, SPITRACE_WRITE, value, t0 );
+	pthread_mutex_unlock( &spi_lock );
+}
+
+
+
+/****************************************************************/
+// A read clocks out the address byte followed by two dummy bytes, during
+// which the device returns the register value.  Called with spi_lock held.
+static uint16_t ReadRegisterLocked(uint8_t spichannel, uint8_t address)
+{
+	uint64_t t0 = spitrace_enabled ? spitrace_now() : 0;
+	uint16_t value;
+	txbuf[0] = ( (address) << 1) | PIXI_READ; //read
+	txbuf[1] = 0;
+	txbuf[2] = 0;
+	wiringPiSPIDataRW (spichannel, txbuf, 3);
+	value = txbuf[1] << 8 | txbuf[2];
+	if (t0) spitrace_add( spichannel, address, SPITRACE_READ, value, t0 );
+	return value;
 }
 
 
@@ -431,9 +631,9 @@ void WriteRegister(uint8_t spichannel , uint8_t address, uint16_t value)
 uint16_t ReadRegister(uint8_t spichannel  , uint8_t address, bool debug )
 {
 	uint16_t resultat = 0; 
-	txbuf[0] = ( (address) << 1) | PIXI_READ; //write
-	wiringPiSPIDataRW (spichannel, txbuf, 1);  
-	resultat = txbuf[0] << 8 | txbuf[1];
+	pthread_mutex_lock( &spi_lock );
+	resultat = ReadRegisterLocked( spichannel, address );
+	pthread_mutex_unlock( &spi_lock );
 		//post("wiringPi: readreg spichan %d address %d value %d",spichannel, address, resultat);
 	return resultat;
 }
@@ -444,10 +644,9 @@ uint16_t ReadRegister(uint8_t spichannel  , uint8_t address, bool debug )
 uint16_t ReadAnalog( uint8_t spichannel , uint8_t channel)
 {
 	uint16_t resultat = 0;
-	txbuf[0] = ( (PIXI_ADC_DATA + channel) << 1) | PIXI_READ; //write
-	wiringPiSPIDataRW(spichannel, txbuf, 1);
-
-	resultat = txbuf[0] << 8 | txbuf[1];
+	pthread_mutex_lock( &spi_lock );
+	resultat = ReadRegisterLocked( spichannel, PIXI_ADC_DATA + channel );
+	pthread_mutex_unlock( &spi_lock );
 		//post("wiringPi: readAnalog spichan %d chan %d value %d",spichannel, channel, resultat);
 
 	return resultat;
@@ -757,7 +956,10 @@ post("wiringPi: maxconfig");
 /****************************************************************/
 void WriteAnalog(uint8_t spichannel, uint8_t channel, uint16_t value)
 {
+	uint64_t t0;
 
+	pthread_mutex_lock( &spi_lock );
+	t0 = spitrace_enabled ? spitrace_now() : 0;
 	txbuf[0] = ( (PIXI_DAC_DATA + channel)<<1)|PIXI_WRITE; 
 			//post("wiringPi: awrite chan %d ", PIXI_DAC_DATA + channel<<1);
 			//post("wiringPi: awrite buf1 %d ", txbuf[0]);
@@ -766,6 +968,9 @@ void WriteAnalog(uint8_t spichannel, uint8_t channel, uint16_t value)
 	txbuf[2] = value & 0xFF; //valueL
 			//post("wiringPi: awrite buf2 %d ", txbuf[2]);
 	wiringPiSPIDataRW(spichannel, txbuf, 3);
+	if (t0) spitrace_add( spichannel, PIXI_DAC_DATA + channel, SPITRACE_WRITE, value, t0 );
+	if (spichannel < SPI_CHANNELS && channel < PIXI_PORTS) dac_shadow[spichannel][channel] = value + 1;
+	pthread_mutex_unlock( &spi_lock );
 	//post("wiringPi: analogWrite spichan %d channel %d value %d buf %d" ,spichannel , channel, value, txbuf);
 
 }
@@ -831,6 +1036,571 @@ post("wiringPi: setupcomplete");
 
 
 
+/****************************************************************/
+/// CV glide state.  Ports with a glide time or slew limit are not written
+/// directly by spi_write; Pd only stores the target and a background thread
+/// moves each port toward it at a fixed update rate, so a portamento is one
+/// message from Pd instead of a [line] stream.  The thread sleeps on cv_wake
+/// whenever no port is moving.
+#define CV_SPI_CHANNELS SPI_CHANNELS
+#define CV_PORTS        PIXI_PORTS
+#define CV_MAX_CODE     DAC_MAX_CODE
+
+enum { CV_LINEAR = 0, CV_EXPONENTIAL = 1 };
+
+typedef struct cv_port
+{
+  float current;           ///< value the thread last computed, in DAC codes
+  float target;            ///< value most recently sent from Pd
+  float step;              ///< linear glide increment per update
+  float glide_ms;          ///< glide time (linear) or time constant (exponential), 0 for none
+  float slew;              ///< largest change per update, 0 for no limit
+  int shape;               ///< CV_LINEAR or CV_EXPONENTIAL
+  int written;             ///< code last written to the DAC, or -1
+  int active;              ///< nonzero while moving toward target
+} t_cv_port;
+
+static t_cv_port cv_port[CV_SPI_CHANNELS][CV_PORTS];
+static int cv_rate = 1000;                           ///< updates per second
+static int cv_running = 0;
+static pthread_t cv_thread;
+static pthread_mutex_t cv_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cv_wake = PTHREAD_COND_INITIALIZER;
+
+static inline int cv_smoothed( t_cv_port *p )
+{
+  return p->glide_ms > 0 || p->slew > 0;
+}
+
+/****************************************************************/
+// Advance one port by one update and return the code to write, or -1 if the
+// port is idle or the code did not change.  Called with cv_lock held.
+static int cv_advance( t_cv_port *p )
+{
+  float delta = p->target - p->current;
+  int code;
+
+  if ( !p->active ) return -1;
+
+  if ( p->glide_ms <= 0 ) {
+    // slew limiting only
+  } else if ( p->shape == CV_EXPONENTIAL ) {
+    delta *= 1.0f - expf( -1000.0f / (p->glide_ms * cv_rate) );
+  } else {
+    if ( fabsf( p->step ) < fabsf( delta )) delta = p->step;
+  }
+  if ( p->slew > 0 ) {
+    if ( delta > p->slew )  delta = p->slew;
+    if ( delta < -p->slew ) delta = -p->slew;
+  }
+
+  p->current += delta;
+  if ( fabsf( p->target - p->current ) < 0.5f ) {
+    p->current = p->target;
+    p->active = 0;
+  }
+
+  code = (int) (p->current + 0.5f);
+  if ( code == p->written ) return -1;
+  p->written = code;
+  return code;
+}
+
+// True if no port is moving toward its target.  Called with cv_lock held.
+static int cv_idle( void )
+{
+  int chan, port;
+  for ( chan = 0; chan < CV_SPI_CHANNELS; chan++ )
+    for ( port = 0; port < CV_PORTS; port++ )
+      if ( cv_port[chan][port].active ) return 0;
+  return 1;
+}
+
+/****************************************************************/
+// Update thread: wake on an absolute monotonic schedule so the CV rate stays
+// fixed regardless of how long the SPI writes take.  Once every port has
+// reached its target it waits for cv_set_target instead of ticking on.
+static void *cv_update( void *arg )
+{
+  struct timespec next;
+  int codes[CV_SPI_CHANNELS][CV_PORTS];
+  int chan, port;
+
+  (void) arg;
+  clock_gettime( CLOCK_MONOTONIC, &next );
+  for (;;) {
+    long period_ns;
+    int idle;
+
+    pthread_mutex_lock( &cv_lock );
+    if ( !cv_running ) {
+      pthread_mutex_unlock( &cv_lock );
+      break;
+    }
+    for ( chan = 0; chan < CV_SPI_CHANNELS; chan++ )
+      for ( port = 0; port < CV_PORTS; port++ )
+	codes[chan][port] = cv_advance( &cv_port[chan][port] );
+    period_ns = 1000000000L / cv_rate;
+    idle = cv_idle();
+    pthread_mutex_unlock( &cv_lock );
+
+    for ( chan = 0; chan < CV_SPI_CHANNELS; chan++ )
+      for ( port = 0; port < CV_PORTS; port++ )
+	if ( codes[chan][port] >= 0 ) WriteAnalog( chan, port, codes[chan][port] );
+
+    if ( idle ) {
+      // a target may have arrived during the writes, so check again under the lock
+      pthread_mutex_lock( &cv_lock );
+      while ( cv_running && cv_idle() ) pthread_cond_wait( &cv_wake, &cv_lock );
+      pthread_mutex_unlock( &cv_lock );
+      clock_gettime( CLOCK_MONOTONIC, &next );
+      continue;
+    }
+
+    next.tv_nsec += period_ns;
+    while ( next.tv_nsec >= 1000000000L ) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL );
+  }
+  return NULL;
+}
+
+/****************************************************************/
+static void cv_start( void )
+{
+  if ( cv_running ) return;
+  cv_running = 1;
+  if ( pthread_create( &cv_thread, NULL, cv_update, NULL ) ) {
+    post("wiringPi: unable to start cv glide thread.");
+    cv_running = 0;
+  }
+}
+
+/****************************************************************/
+// Set a new target.  Returns zero if the port has no glide or slew, in which
+// case the caller writes the DAC directly as before.
+static int cv_set_target( int chan, int port, int value )
+{
+  t_cv_port *p;
+
+  if ( chan < 0 || chan >= CV_SPI_CHANNELS || port < 0 || port >= CV_PORTS ) return 0;
+  p = &cv_port[chan][port];
+
+  pthread_mutex_lock( &cv_lock );
+  if ( !cv_smoothed( p )) {
+    p->current = p->target = value;
+    p->written = value;
+    pthread_mutex_unlock( &cv_lock );
+    return 0;
+  }
+  if ( value < 0 ) value = 0;
+  if ( value > CV_MAX_CODE ) value = CV_MAX_CODE;
+  p->target = value;
+  // a linear glide covers any distance in the same time
+  p->step = (p->target - p->current) * 1000.0f / (p->glide_ms * cv_rate + 1e-9f);
+  p->active = 1;
+  pthread_cond_signal( &cv_wake );
+  pthread_mutex_unlock( &cv_lock );
+  return 1;
+}
+
+/****************************************************************/
+static void cv_configure( int chan, int port, float glide_ms, int shape, float slew_per_ms )
+{
+  t_cv_port *p;
+
+  if ( chan < 0 || chan >= CV_SPI_CHANNELS || port < 0 || port >= CV_PORTS ) {
+    post("wiringPi error: cv port %d %d out of range.", chan, port );
+    return;
+  }
+  p = &cv_port[chan][port];
+
+  pthread_mutex_lock( &cv_lock );
+  if ( glide_ms >= 0 ) {
+    p->glide_ms = glide_ms;
+    p->shape = shape;
+  }
+  if ( slew_per_ms >= 0 ) p->slew = slew_per_ms * 1000.0f / cv_rate;
+  pthread_mutex_unlock( &cv_lock );
+
+  if ( cv_smoothed( p )) cv_start();
+}
+
+
+
+
+
+
+
+
+
+/****************************************************************/
+/// Telemetry state.  A low priority thread reads the temperature and
+/// over-current registers one at a time, each in its own short bus slot taken
+/// with a trylock, so it never holds up a DAC write.  The results are kept in
+/// a snapshot which the owning Pd object publishes from its own clock.
+#define TELEMETRY_DEVICE_ID 0x0424
+
+typedef struct telemetry_snapshot
+{
+  float temp[3];           ///< internal, external 1 and external 2 in degrees C
+  uint32_t overcurrent;    ///< one bit per port
+  unsigned int reads;      ///< register reads completed
+  unsigned int mismatches; ///< device id or DAC read-back mismatches
+  unsigned int busy;       ///< slots skipped because the bus was in use
+} t_telemetry_snapshot;
+
+static t_telemetry_snapshot telemetry;
+static int telemetry_spichannel = 0;
+static int telemetry_period_ms = 1000;
+static volatile int telemetry_running = 0;
+static pthread_t telemetry_thread;
+static pthread_mutex_t telemetry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t telemetry_wake = PTHREAD_COND_INITIALIZER;   ///< ends the pause early on stop
+
+/****************************************************************/
+// Temperatures are 12-bit two's complement in 0.125 degree steps.
+static float decode_temperature( uint16_t data )
+{
+  int raw = data & 0x0FFF;
+  if (raw & 0x0800) raw -= 0x1000;
+  return raw * 0.125f;
+}
+
+/****************************************************************/
+// Read one register in a bus slot of its own.  Gives up after a few tries
+// if the bus stays busy and returns -1.
+static int telemetry_read( int spichannel, uint8_t address )
+{
+  int tries;
+  uint16_t value;
+  for ( tries = 0; tries < 20; tries++ ) {
+    if ( pthread_mutex_trylock( &spi_lock ) == 0 ) {
+      value = ReadRegisterLocked( spichannel, address );
+      pthread_mutex_unlock( &spi_lock );
+      return value;
+    }
+    pthread_mutex_lock( &telemetry_lock );
+    telemetry.busy++;
+    pthread_mutex_unlock( &telemetry_lock );
+    usleep( 200 );
+  }
+  return -1;
+}
+
+/****************************************************************/
+static void *telemetry_poll( void *arg )
+{
+  static const uint8_t temp_reg[3] = { PIXI_INT_TEMP_DATA, PIXI_EXT1_TEMP_DATA, PIXI_EXT2_TEMP_DATA };
+  struct timespec next;
+  int port = 0;
+
+  (void) arg;
+  clock_gettime( CLOCK_REALTIME, &next );
+  while ( telemetry_running ) {
+    int spichannel = telemetry_spichannel;
+    int values[6], expected, i, mismatch = 0, reads = 0;
+
+    for ( i = 0; i < 3; i++ ) values[i] = telemetry_read( spichannel, temp_reg[i] );
+    values[3] = telemetry_read( spichannel, PIXI_OVERCURRENT_STATUS_0_15 );
+    values[4] = telemetry_read( spichannel, PIXI_OVERCURRENT_STATUS_16_19 );
+    values[5] = telemetry_read( spichannel, PIXI_DEVICE_ID );
+    if ( values[5] >= 0 && values[5] != TELEMETRY_DEVICE_ID ) mismatch++;
+
+    // read back one DAC port per pass and compare it with the last write
+    expected = dac_shadow[spichannel][port];
+    if ( expected ) {
+      int readback = telemetry_read( spichannel, PIXI_DAC_DATA + port );
+      // a glide may have written the port between the two reads, so only
+      // count it if the shadow is still the same afterwards
+      if ( readback >= 0 && (readback & DACDAT) != expected - 1
+	   && dac_shadow[spichannel][port] == expected ) mismatch++;
+      if ( readback >= 0 ) reads++;
+    }
+    port = (port + 1) % PIXI_PORTS;
+
+    pthread_mutex_lock( &telemetry_lock );
+    for ( i = 0; i < 3; i++ ) if ( values[i] >= 0 ) telemetry.temp[i] = decode_temperature( values[i] );
+    if ( values[3] >= 0 && values[4] >= 0 )
+      telemetry.overcurrent = (uint32_t) values[3] | ((uint32_t) (values[4] & 0x0F) << 16);
+    for ( i = 0; i < 6; i++ ) if ( values[i] >= 0 ) reads++;
+    telemetry.reads += reads;
+    telemetry.mismatches += mismatch;
+
+    // pause until the next poll, or until telemetry_stop wakes us
+    next.tv_sec  += telemetry_period_ms / 1000;
+    next.tv_nsec += (telemetry_period_ms % 1000) * 1000000L;
+    if ( next.tv_nsec >= 1000000000L ) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    while ( telemetry_running
+	    && pthread_cond_timedwait( &telemetry_wake, &telemetry_lock, &next ) != ETIMEDOUT );
+    pthread_mutex_unlock( &telemetry_lock );
+  }
+  return NULL;
+}
+
+/****************************************************************/
+static void telemetry_stop( void )
+{
+  if ( !telemetry_running ) return;
+  pthread_mutex_lock( &telemetry_lock );
+  telemetry_running = 0;
+  pthread_cond_signal( &telemetry_wake );
+  pthread_mutex_unlock( &telemetry_lock );
+  pthread_join( telemetry_thread, NULL );
+}
+
+/****************************************************************/
+static void telemetry_start( int spichannel, int period_ms )
+{
+  telemetry_stop();
+  telemetry_spichannel = spichannel;
+  telemetry_period_ms = period_ms;
+  telemetry_running = 1;
+  if ( pthread_create( &telemetry_thread, NULL, telemetry_poll, NULL ) ) {
+    post("wiringPi: unable to start telemetry thread.");
+    telemetry_running = 0;
+    return;
+  }
+  // The thread stays at normal priority: it takes spi_lock, and at a low
+  // priority it could be preempted while holding it and stall the DAC writes
+  // of Pd and the CV thread.  Its cost is kept low by the poll period.
+}
+
+
+
+
+
+
+
+
+
+/****************************************************************/
+/// Character LCD state.  There is only one display, so like the SPI buffers it
+/// is kept globally.  Pd only ever writes the desired contents into lcd_frame;
+/// a background thread owns the display handle and copies the cells which
+/// differ from lcd_shown, at most once per lcd_period_ms.  This replaces
+/// forking ./wiringPi/examples/lcd through [shell] for every update.
+#define LCD_MAX_ROWS 4
+#define LCD_MAX_COLS 40
+
+static int lcd_fd = -1;                              ///< wiringPi lcd handle, or -1 if closed
+static int lcd_rows = 0;
+static int lcd_cols = 0;
+static char lcd_frame[LCD_MAX_ROWS][LCD_MAX_COLS];   ///< desired contents, written from Pd
+static char lcd_shown[LCD_MAX_ROWS][LCD_MAX_COLS];   ///< contents currently on the glass
+static int lcd_dirty = 0;                            ///< set when lcd_frame changed
+static int lcd_running = 0;                          ///< refresh thread keeps going while set
+static int lcd_period_ms = 50;                       ///< minimum time between refreshes
+static pthread_t lcd_thread;
+static pthread_mutex_t lcd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lcd_wake = PTHREAD_COND_INITIALIZER;
+
+/****************************************************************/
+// Refresh thread: wait for a change, write only the cells that differ, then
+// sleep out the rest of the refresh period so bursts of updates coalesce.
+static void *lcd_refresh( void *arg )
+{
+  char frame[LCD_MAX_ROWS][LCD_MAX_COLS];
+  int row, col, period;
+  struct timespec pause;
+
+  (void) arg;
+  for (;;) {
+    pthread_mutex_lock( &lcd_lock );
+    while ( lcd_running && !lcd_dirty ) pthread_cond_wait( &lcd_wake, &lcd_lock );
+    if ( !lcd_running ) {
+      pthread_mutex_unlock( &lcd_lock );
+      break;
+    }
+    memcpy( frame, lcd_frame, sizeof(frame) );
+    lcd_dirty = 0;
+    period = lcd_period_ms;
+    pthread_mutex_unlock( &lcd_lock );
+
+    for ( row = 0; row < lcd_rows; row++ ) {
+      int cursor = -1;   // column the display cursor is known to be at
+      for ( col = 0; col < lcd_cols; col++ ) {
+	if ( frame[row][col] == lcd_shown[row][col] ) continue;
+	// the controller auto-increments, so only reposition after a gap
+	if ( cursor != col ) lcdPosition( lcd_fd, col, row );
+	lcdPutchar( lcd_fd, frame[row][col] );
+	lcd_shown[row][col] = frame[row][col];
+	cursor = col + 1;
+      }
+    }
+
+    pause.tv_sec  = period / 1000;
+    pause.tv_nsec = (period % 1000) * 1000000L;
+    nanosleep( &pause, NULL );
+  }
+  return NULL;
+}
+
+/****************************************************************/
+// Open the display and start the refresh thread.  The pin numbers use the
+// Broadcom numbering scheme set up in wiringPi_setup.
+static void lcd_open( int rows, int cols, int rs, int strb, int d0, int d1, int d2, int d3 )
+{
+  if ( lcd_fd >= 0 ) {
+    post("wiringPi: lcd already open.");
+    return;
+  }
+  if ( rows < 1 || rows > LCD_MAX_ROWS || cols < 1 || cols > LCD_MAX_COLS ) {
+    post("wiringPi error: lcd size must be at most %d rows by %d columns.", LCD_MAX_ROWS, LCD_MAX_COLS );
+    return;
+  }
+
+  lcd_fd = lcdInit( rows, cols, 4, rs, strb, d0, d1, d2, d3, 0, 0, 0, 0 );
+  if ( lcd_fd < 0 ) {
+    post("wiringPi: lcdInit returned error %d.", lcd_fd );
+    return;
+  }
+  lcdClear( lcd_fd );
+
+  lcd_rows = rows;
+  lcd_cols = cols;
+  memset( lcd_frame, ' ', sizeof(lcd_frame) );
+  memset( lcd_shown, ' ', sizeof(lcd_shown) );
+  lcd_dirty = 0;
+  lcd_running = 1;
+
+  if ( pthread_create( &lcd_thread, NULL, lcd_refresh, NULL ) ) {
+    post("wiringPi: unable to start lcd refresh thread.");
+    lcd_running = 0;
+    lcd_fd = -1;
+    return;
+  }
+  post("wiringPi: opened %dx%d lcd, refresh every %d ms.", cols, rows, lcd_period_ms );
+}
+
+/****************************************************************/
+static void lcd_close( void )
+{
+  if ( lcd_fd < 0 ) return;
+
+  pthread_mutex_lock( &lcd_lock );
+  lcd_running = 0;
+  pthread_cond_signal( &lcd_wake );
+  pthread_mutex_unlock( &lcd_lock );
+  pthread_join( lcd_thread, NULL );
+  lcd_fd = -1;
+}
+
+/****************************************************************/
+// Copy text into the framebuffer at a column and row.  The atoms are joined
+// with single spaces; like lcdPutchar, text runs on into the next row and
+// stops at the end of the display.
+static void lcd_print( int col, int row, int argcount, t_atom *argvec )
+{
+  char text[LCD_MAX_ROWS * LCD_MAX_COLS + 1];
+  int i, len;
+
+  if ( lcd_fd < 0 ) return;
+  if ( row < 0 || row >= lcd_rows || col < 0 || col >= lcd_cols ) return;
+
+  pthread_mutex_lock( &lcd_lock );
+  for ( i = 0; i < argcount && row < lcd_rows; i++ ) {
+    text[0] = ' ';
+    atom_string( &argvec[i], text + 1, sizeof(text) - 1 );
+    for ( len = (i > 0) ? 0 : 1; text[len] && row < lcd_rows; len++ ) {
+      lcd_frame[row][col] = text[len];
+      if ( ++col == lcd_cols ) {
+	col = 0;
+	row++;
+      }
+    }
+  }
+  lcd_dirty = 1;
+  pthread_cond_signal( &lcd_wake );
+  pthread_mutex_unlock( &lcd_lock );
+}
+
+/****************************************************************/
+static void lcd_clear_frame( void )
+{
+  if ( lcd_fd < 0 ) return;
+
+  pthread_mutex_lock( &lcd_lock );
+  memset( lcd_frame, ' ', sizeof(lcd_frame) );
+  lcd_dirty = 1;
+  pthread_cond_signal( &lcd_wake );
+  pthread_mutex_unlock( &lcd_lock );
+}
+
+
+
+
+
+
+
+
+
+/****************************************************************/
+// Publish the telemetry snapshot on the outlet.  Alarms are sent when they
+// change; the temperature alarm clears 2 degrees below the threshold.
+#define ALARM_TEMP        1
+#define ALARM_OVERCURRENT 2
+#define ALARM_BUS         4
+
+static void pdwiringPi_telemetry_tick( t_pdwiringPi *x )
+{
+  t_telemetry_snapshot snap;
+  t_atom a[3];
+  int alarm = 0, i;
+  float hottest;
+
+  pthread_mutex_lock( &telemetry_lock );
+  snap = telemetry;
+  pthread_mutex_unlock( &telemetry_lock );
+
+  SETFLOAT( &a[0], snap.temp[0] );
+  SETFLOAT( &a[1], snap.temp[1] );
+  SETFLOAT( &a[2], snap.temp[2] );
+  outlet_anything( x->x_outlet, gensym("temperature"), 3, a );
+  SETFLOAT( &a[0], snap.overcurrent );
+  outlet_anything( x->x_outlet, gensym("overcurrent"), 1, a );
+  SETFLOAT( &a[0], snap.reads );
+  SETFLOAT( &a[1], snap.mismatches );
+  SETFLOAT( &a[2], snap.busy );
+  outlet_anything( x->x_outlet, gensym("bus"), 3, a );
+
+  hottest = snap.temp[0];
+  for ( i = 1; i < 3; i++ ) if ( snap.temp[i] > hottest ) hottest = snap.temp[i];
+  if ( hottest >= x->telemetry_limit ||
+       ( (x->telemetry_alarm & ALARM_TEMP) && hottest > x->telemetry_limit - 2 ))
+    alarm |= ALARM_TEMP;
+  if ( snap.overcurrent ) alarm |= ALARM_OVERCURRENT;
+  if ( snap.mismatches != x->telemetry_seen ) alarm |= ALARM_BUS;
+  x->telemetry_seen = snap.mismatches;
+
+  if ( alarm != x->telemetry_alarm ) {
+    SETFLOAT( &a[0], alarm & ALARM_TEMP ? 1 : 0 );
+    SETFLOAT( &a[1], alarm & ALARM_OVERCURRENT ? 1 : 0 );
+    SETFLOAT( &a[2], alarm & ALARM_BUS ? 1 : 0 );
+    outlet_anything( x->x_outlet, gensym("alarm"), 3, a );
+    if ( (alarm & ~x->telemetry_alarm) & ALARM_TEMP )
+      post("wiringPi: warning, MAX11300 at %.1f degrees C.", hottest );
+    if ( (alarm & ~x->telemetry_alarm) & ALARM_OVERCURRENT )
+      post("wiringPi: warning, MAX11300 over-current on ports 0x%05x.", snap.overcurrent );
+    x->telemetry_alarm = alarm;
+  }
+
+  clock_delay( x->telemetry_clock, telemetry_period_ms );
+}
+
+
+
+
+
+
+
+
+
 /****************************************************************/
 /// Process a list representing a function call or more elaborate I/O command.
 
@@ -844,35 +1614,35 @@ static void pdwiringPi_eval( t_pdwiringPi *x, t_symbol *selector, int argcount,
   }
 
   // test for a variety of function call forms
-  if ( symbol_matches( selector, "digitalRead" ) && argcount == 1) {
+  if ( selector == sym_digitalRead && argcount == 1) {
     outlet_float( x->x_outlet, (float) digitalRead( atom_getint( &argvec[0] )));
     return;
 
-  } else if ( symbol_matches( selector, "digitalWrite" ) && argcount == 2) {
+  } else if ( selector == sym_digitalWrite && argcount == 2) {
     digitalWrite( atom_getint(&argvec[0]), atom_getint(&argvec[1]) );
     return;
 
-  } else if ( symbol_matches( selector, "pwmWrite" ) && argcount == 2) {
+  } else if ( selector == sym_pwmWrite && argcount == 2) {
     // "The Raspberry Pi has one on-board PWM pin, pin 1 (BMC_GPIO 18, Phys 12)
     // and the range is 0-1024."
     pwmWrite( atom_getint(&argvec[0]), atom_getint(&argvec[1]) );
     if (sys_mode) post("wiringPi: Warning, pwmWrite has no effect in Sys mode.");
     return;
 
-  } else if ( symbol_matches( selector, "pinMode" ) && argcount == 2) {
+  } else if ( selector == sym_pinMode && argcount == 2) {
     int mode = atom_to_pin_mode( &argvec[1] );
     set_pin_mode( atom_getint(&argvec[0]), mode );
     return;
 
-  } else if ( symbol_matches( selector, "wpiPinToGpio" ) && argcount == 1) {
+  } else if ( selector == sym_wpiPinToGpio && argcount == 1) {
     outlet_float( x->x_outlet, (float) wpiPinToGpio( atom_getint(&argvec[0]) ));
     return;
 
-  } else if ( symbol_matches( selector, "physPinToGpio" ) && argcount == 1) {
+  } else if ( selector == sym_physPinToGpio && argcount == 1) {
     outlet_float( x->x_outlet, (float) physPinToGpio( atom_getint(&argvec[0]) ));
     return;
 
-  } else if ( symbol_matches( selector, "piBoardRev" ) && argcount == 0) {
+  } else if ( selector == sym_piBoardRev && argcount == 0) {
     outlet_float( x->x_outlet, (float) piBoardRev() );
     return;
 
@@ -881,7 +1651,7 @@ static void pdwiringPi_eval( t_pdwiringPi *x, t_symbol *selector, int argcount,
 
 
 
-  } else if ( symbol_matches( selector, "load_spi_driver" ) && argcount == 0) {
+  } else if ( selector == sym_load_spi_driver && argcount == 0) {
     char *command = "gpio load spi";
     post("wiringPi: running '%s' to make sure SPI drivers are loaded.", command );
     system(command);
@@ -894,7 +1664,7 @@ static void pdwiringPi_eval( t_pdwiringPi *x, t_symbol *selector, int argcount,
 
 
 
-  } else if ( symbol_matches( selector, "spi_init" )) {
+  } else if ( selector == sym_spi_init) {
     // specialize an object instance to represent an SPI port
     //  [ spi_init <spi-number> <spi-speed> ]
     if (argcount == 2) {
@@ -916,14 +1686,15 @@ static void pdwiringPi_eval( t_pdwiringPi *x, t_symbol *selector, int argcount,
 
 
 
-  } else if ( symbol_matches( selector, "spi_write" )) {
+  } else if ( selector == sym_spi_write) {
 	  
     if (argcount == 3) {
 		
 		int spichannel = atom_getint( &argvec[0] );
 		int channel = atom_getint( &argvec[1] );
 		int value   = (atom_getint( &argvec[2]));
-		WriteAnalog(spichannel,channel,value);
+		if ( !cv_set_target( spichannel, channel, value ))
+			WriteAnalog(spichannel,channel,value);
 		//post("wiringPi : attempt write spichan %d chan %d val %d ", spichannel, channel, value);
 		return;
 
@@ -932,7 +1703,124 @@ static void pdwiringPi_eval( t_pdwiringPi *x, t_symbol *selector, int argcount,
       post("wiringPi error: spi_init requires spi_channel , channel and cv values");
     }
 
-  } else if ( symbol_matches( selector, "reboot" )) {
+  } else if ( selector == sym_lcd) {
+    // write text into the lcd framebuffer, same form as the tolcd messages
+    //  [ lcd <column> <row> <text...> ]
+    if (argcount >= 2) {
+      lcd_print( atom_getint( &argvec[0] ), atom_getint( &argvec[1] ), argcount - 2, argvec + 2 );
+    } else {
+      post("wiringPi error: lcd requires column, row and text.");
+    }
+    return;
+
+  } else if ( selector == sym_lcd_clear) {
+    lcd_clear_frame();
+    return;
+
+  } else if ( selector == sym_lcd_init) {
+    // open the display in 4-bit mode and start the refresh thread
+    //  [ lcd_init ]  defaults to the 16x2 wiring of ./wiringPi/examples/lcd 4 16 2
+    //  [ lcd_init <rows> <cols> <rs> <strb> <d4> <d5> <d6> <d7> ]  Broadcom pin numbers
+    if (argcount == 0) {
+      lcd_open( 2, 16, 7, 8, 23, 24, 25, 4 );
+    } else if (argcount == 8) {
+      lcd_open( atom_getint( &argvec[0] ), atom_getint( &argvec[1] ),
+		atom_getint( &argvec[2] ), atom_getint( &argvec[3] ),
+		atom_getint( &argvec[4] ), atom_getint( &argvec[5] ),
+		atom_getint( &argvec[6] ), atom_getint( &argvec[7] ) );
+    } else {
+      post("wiringPi error: lcd_init requires rows, cols, rs, strb and four data pins.");
+    }
+    return;
+
+  } else if ( selector == sym_lcd_rate && argcount == 1) {
+    // cap the refresh rate in Hz
+    int hz = atom_getint( &argvec[0] );
+    if (hz < 1) hz = 1;
+    pthread_mutex_lock( &lcd_lock );
+    lcd_period_ms = 1000 / hz;
+    pthread_mutex_unlock( &lcd_lock );
+    return;
+
+  } else if ( selector == sym_lcd_close && argcount == 0) {
+    lcd_close();
+    return;
+
+  } else if ( selector == sym_spi_glide) {
+    // glide a port to each new spi_write target instead of jumping
+    //  [ spi_glide <spi_channel> <channel> <ms> [linear|exponential] ]  0 ms turns it off
+    if (argcount == 3 || argcount == 4) {
+      int shape = ( argcount == 4 && atom_matches( &argvec[3], "exponential" )) ? CV_EXPONENTIAL : CV_LINEAR;
+      cv_configure( atom_getint( &argvec[0] ), atom_getint( &argvec[1] ),
+		    atom_getfloat( &argvec[2] ), shape, -1 );
+    } else {
+      post("wiringPi error: spi_glide requires spi_channel, channel and time values");
+    }
+    return;
+
+  } else if ( selector == sym_spi_slew) {
+    // limit how fast a port may move, in DAC codes per millisecond
+    //  [ spi_slew <spi_channel> <channel> <codes-per-ms> ]  0 turns it off
+    if (argcount == 3) {
+      cv_configure( atom_getint( &argvec[0] ), atom_getint( &argvec[1] ),
+		    -1, CV_LINEAR, atom_getfloat( &argvec[2] ) );
+    } else {
+      post("wiringPi error: spi_slew requires spi_channel, channel and rate values");
+    }
+    return;
+
+  } else if ( selector == sym_cv_rate && argcount == 1) {
+    // internal CV update rate in Hz for glides and slew limits
+    int hz = atom_getint( &argvec[0] );
+    int chan, port;
+    if (hz < 100) hz = 100;
+    if (hz > 20000) hz = 20000;
+    // slew limits and linear glide steps in progress are per update
+    pthread_mutex_lock( &cv_lock );
+    for ( chan = 0; chan < CV_SPI_CHANNELS; chan++ )
+      for ( port = 0; port < CV_PORTS; port++ ) {
+	cv_port[chan][port].slew *= (float) cv_rate / hz;
+	cv_port[chan][port].step *= (float) cv_rate / hz;
+      }
+    cv_rate = hz;
+    pthread_mutex_unlock( &cv_lock );
+    return;
+
+  } else if ( selector == sym_telemetry) {
+    // poll temperatures, over-current flags and bus health in the background
+    //  [ telemetry <spi_channel> <rate-hz> [alarm-celsius] ]  rate 0 stops
+    if (argcount == 2 || argcount == 3) {
+      float hz = atom_getfloat( &argvec[1] );
+      if (hz <= 0) {
+	telemetry_stop();
+	if (x->telemetry_clock) clock_unset( x->telemetry_clock );
+	return;
+      }
+      if (hz > 50) hz = 50;
+      if (!x->telemetry_clock) x->telemetry_clock = clock_new( x, (t_method) pdwiringPi_telemetry_tick );
+      x->telemetry_limit = (argcount == 3) ? atom_getfloat( &argvec[2] ) : 70;
+      x->telemetry_alarm = 0;
+      x->telemetry_seen = 0;
+      telemetry_start( atom_getint( &argvec[0] ), (int) (1000 / hz) );
+      clock_delay( x->telemetry_clock, telemetry_period_ms );
+    } else {
+      post("wiringPi error: telemetry requires spi_channel and rate values");
+    }
+    return;
+
+  } else if ( selector == sym_spi_trace) {
+    // record every SPI transfer into a binary file for pdmax11300/spitrace
+    //  [ spi_trace <file> ]  start, replacing any trace in progress
+    //  [ spi_trace stop ]    stop and close the file
+    if (argcount == 1 && argvec[0].a_type == A_SYMBOL) {
+      if (atom_matches( &argvec[0], "stop" )) spitrace_stop();
+      else spitrace_start( atom_getsymbol( &argvec[0] )->s_name );
+    } else {
+      post("wiringPi error: spi_trace requires a file name or stop");
+    }
+    return;
+
+  } else if ( selector == sym_reboot) {
 		system("reboot");
   } 
 
@@ -955,6 +1843,7 @@ else {
 ///
 /// The creation arguments are all optional and are interpreted as follows:
 ///  [ wiringPi pin <pin-number> <mode-symbol> ] make instance pin-specific
+///  [ wiringPi dac <spi-channel> <port> [<min> <max>] ] make instance port-specific
 
 static void *pdwiringPi_new(t_symbol *selector, int argcount, t_atom *argvec)
 {
@@ -968,6 +1857,13 @@ static void *pdwiringPi_new(t_symbol *selector, int argcount, t_atom *argvec)
   x->spi_speed   = -1;
   x->spi_fd      = -1;
 
+  x->dac_spi    = 0;
+  x->dac_port   = -1;
+  x->dac_scale  = 1;
+  x->dac_offset = 0;
+
+  x->telemetry_clock = NULL;
+
 
  
 
@@ -989,6 +1885,31 @@ static void *pdwiringPi_new(t_symbol *selector, int argcount, t_atom *argvec)
       } else {
 	post("wiringPi: incorrect number of creation arguments for pin.");
       }
+
+    // define the object instance as 'port-specific' representing a single DAC
+    // port; a float in [min, max] is scaled to the full DAC range, or taken as
+    // a raw code without a range.  The SPI channel still needs spi_init.
+    //  [ wiringPi dac <spi-channel> <port> [<min> <max>] ]
+    } else if ( atom_matches( arg0, "dac" )) {
+      if (argcount == 3 || argcount == 5) {
+	int spichannel = atom_getint( &argvec[1] );
+	int port = atom_getint( &argvec[2] );
+	float min = (argcount == 5) ? atom_getfloat( &argvec[3] ) : 0;
+	float max = (argcount == 5) ? atom_getfloat( &argvec[4] ) : DAC_MAX_CODE;
+
+	if (spichannel < 0 || spichannel >= SPI_CHANNELS || port < 0 || port >= PIXI_PORTS) {
+	  post("wiringPi error: dac port %d %d out of range.", spichannel, port );
+	} else if (max == min) {
+	  post("wiringPi error: dac range must not be empty.");
+	} else {
+	  x->dac_spi    = spichannel;
+	  x->dac_port   = port;
+	  x->dac_scale  = DAC_MAX_CODE / (max - min);
+	  x->dac_offset = -min * x->dac_scale;
+	}
+      } else {
+	post("wiringPi: incorrect number of creation arguments for dac.");
+      }
     } else {
       post("wiringPi: unrecognized creation arguments.");
     }
@@ -1015,6 +1936,10 @@ static void *pdwiringPi_new(t_symbol *selector, int argcount, t_atom *argvec)
 static void pdwiringPi_free(t_pdwiringPi *x)
 {
   if (x) {
+    if (x->telemetry_clock) {
+      telemetry_stop();
+      clock_free( x->telemetry_clock );
+    }
     outlet_free( x->x_outlet );
 	inlet_free(x->x_in2);  
 	inlet_free(x->x_in3);   
@@ -1051,7 +1976,30 @@ void wiringPi_setup(void)
 				0,                               // int flags
 				A_GIMME, 0);                     // t_atomtype arg1, ...
 
-  // instances specialized to specific pins can accept bangs and floats
+  // intern the message selectors once
+  sym_digitalRead     = gensym("digitalRead");
+  sym_digitalWrite    = gensym("digitalWrite");
+  sym_pwmWrite        = gensym("pwmWrite");
+  sym_pinMode         = gensym("pinMode");
+  sym_wpiPinToGpio    = gensym("wpiPinToGpio");
+  sym_physPinToGpio   = gensym("physPinToGpio");
+  sym_piBoardRev      = gensym("piBoardRev");
+  sym_load_spi_driver = gensym("load_spi_driver");
+  sym_spi_init        = gensym("spi_init");
+  sym_spi_write       = gensym("spi_write");
+  sym_spi_glide       = gensym("spi_glide");
+  sym_spi_slew        = gensym("spi_slew");
+  sym_cv_rate         = gensym("cv_rate");
+  sym_lcd             = gensym("lcd");
+  sym_lcd_clear       = gensym("lcd_clear");
+  sym_lcd_init        = gensym("lcd_init");
+  sym_lcd_rate        = gensym("lcd_rate");
+  sym_lcd_close       = gensym("lcd_close");
+  sym_telemetry       = gensym("telemetry");
+  sym_spi_trace       = gensym("spi_trace");
+  sym_reboot          = gensym("reboot");
+
+  // instances specialized to specific pins or DAC ports can accept floats
   class_addbang ( pdwiringPi_class, pdwiringPi_bang );    // t_class *c, t_method fn
   class_addfloat( pdwiringPi_class, pdwiringPi_float );  // t_class *c, t_method fn
 
@@ -0,0 +1,236 @@
+/// spitrace.c : offline replay and analysis of a MAX11300 SPI trace
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Reads a file written by [wiringPi] after [spi_trace <file>( and replays it
+// against a software model of the device registers.  The report covers the
+// whole trace (span, transfer rate, bus occupancy, transfer durations and
+// the longest quiet gap) and then each register that was touched: writes,
+// reads, redundant writes which stored the value the register already held,
+// update rate and the shortest, mean and longest interval between writes.
+// DAC data reads are checked against the last value written.
+//
+// Build on the Pi or any Linux machine:
+//   gcc -O2 -o spitrace spitrace.c
+//
+// usage: spitrace [-d] [-m] [-c <spi-channel>] <trace-file>
+//   -d  dump every record as text while replaying
+//   -m  print the register model at the end of the trace
+//   -c  only replay transfers on one SPI channel
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "spitrace.h"
+
+#define CHANNELS   2
+#define REGISTERS  128           // the address is seven bits
+
+#define PIXI_DEVICE_ID    0x00
+#define PIXI_DEVICE_CTRL  0x10
+#define PIXI_PORT_CONFIG  0x20
+#define PIXI_ADC_DATA     0x40
+#define PIXI_DAC_DATA     0x60
+#define PIXI_PORTS        20
+
+/****************************************************************/
+/// Model and statistics for one register.
+typedef struct reg_state
+{
+  int known;               ///< the model holds a value
+  uint16_t value;          ///< last value written or read
+  unsigned long writes, reads, redundant, readback_errors;
+  uint64_t last_write_ns;
+  uint64_t min_interval, max_interval, sum_interval;
+  unsigned long intervals;
+} t_reg_state;
+
+static t_reg_state model[CHANNELS][REGISTERS];
+
+/****************************************************************/
+// A readable name for the registers the external uses.
+static const char *register_name( int address, char *buf, size_t len )
+{
+  if ( address >= PIXI_DAC_DATA && address < PIXI_DAC_DATA + PIXI_PORTS )
+    snprintf( buf, len, "DAC_DATA %d", address - PIXI_DAC_DATA );
+  else if ( address >= PIXI_ADC_DATA && address < PIXI_ADC_DATA + PIXI_PORTS )
+    snprintf( buf, len, "ADC_DATA %d", address - PIXI_ADC_DATA );
+  else if ( address >= PIXI_PORT_CONFIG && address < PIXI_PORT_CONFIG + PIXI_PORTS )
+    snprintf( buf, len, "PORT_CONFIG %d", address - PIXI_PORT_CONFIG );
+  else if ( address == PIXI_DEVICE_ID )   snprintf( buf, len, "DEVICE_ID" );
+  else if ( address == PIXI_DEVICE_CTRL ) snprintf( buf, len, "DEVICE_CTRL" );
+  else if ( address >= 0x08 && address <= 0x0A ) snprintf( buf, len, "TEMP_DATA %d", address - 0x08 );
+  else if ( address == 0x04 || address == 0x05 ) snprintf( buf, len, "OVERCURRENT %d", address - 0x04 );
+  else snprintf( buf, len, "0x%02x", address );
+  return buf;
+}
+
+static int compare_u32( const void *a, const void *b )
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+/****************************************************************/
+// Apply one transfer to the model.
+static void replay( const spitrace_record *r, int dump, uint64_t start_ns )
+{
+  t_reg_state *s = &model[r->spichannel][r->address & (REGISTERS - 1)];
+  char name[32];
+
+  if ( dump )
+    printf( "%12.6f %s ch %d %-16s 0x%04x %6.1f us\n", (r->t_ns - start_ns) * 1e-9,
+	    r->flags == SPITRACE_READ ? "read " : "write", r->spichannel,
+	    register_name( r->address, name, sizeof(name) ), r->value, r->duration_ns * 1e-3 );
+
+  if ( r->flags == SPITRACE_READ ) {
+    s->reads++;
+    // DAC data reads back what was written; other registers change by themselves
+    if ( r->address >= PIXI_DAC_DATA && r->address < PIXI_DAC_DATA + PIXI_PORTS
+	 && s->known && s->value != r->value )
+      s->readback_errors++;
+    if ( r->address < PIXI_DAC_DATA || r->address >= PIXI_DAC_DATA + PIXI_PORTS ) {
+      s->known = 1;
+      s->value = r->value;
+    }
+    return;
+  }
+
+  s->writes++;
+  if ( s->known && s->value == r->value ) s->redundant++;
+  s->known = 1;
+  s->value = r->value;
+  if ( s->last_write_ns ) {
+    uint64_t dt = r->t_ns - s->last_write_ns;
+    if ( !s->intervals || dt < s->min_interval ) s->min_interval = dt;
+    if ( dt > s->max_interval ) s->max_interval = dt;
+    s->sum_interval += dt;
+    s->intervals++;
+  }
+  s->last_write_ns = r->t_ns;
+}
+
+/****************************************************************/
+int main( int argc, char **argv )
+{
+  int dump = 0, print_model = 0, only = -1, opt, c, a;
+  spitrace_header header;
+  spitrace_record r;
+  FILE *f;
+  uint32_t *durations = NULL;
+  size_t count = 0, capacity = 0;
+  uint64_t first = 0, last = 0, busy = 0, gap = 0, gap_at = 0, prev_end = 0;
+  unsigned long writes = 0, reads = 0, redundant = 0, errors = 0;
+  double span;
+
+  while ( (opt = getopt( argc, argv, "dmc:" )) != -1 ) {
+    switch ( opt ) {
+    case 'd': dump = 1; break;
+    case 'm': print_model = 1; break;
+    case 'c': only = atoi( optarg ); break;
+    default:
+      fprintf( stderr, "usage: %s [-d] [-m] [-c <spi-channel>] <trace-file>\n", argv[0] );
+      return 2;
+    }
+  }
+  if ( optind != argc - 1 ) {
+    fprintf( stderr, "usage: %s [-d] [-m] [-c <spi-channel>] <trace-file>\n", argv[0] );
+    return 2;
+  }
+
+  if ( !(f = fopen( argv[optind], "rb" ))) {
+    perror( argv[optind] );
+    return 1;
+  }
+  if ( fread( &header, sizeof(header), 1, f ) != 1 || header.magic != SPITRACE_MAGIC ) {
+    fprintf( stderr, "%s: not an spi trace\n", argv[optind] );
+    return 1;
+  }
+  if ( header.version != SPITRACE_VERSION || header.record_size != sizeof(spitrace_record) ) {
+    fprintf( stderr, "%s: trace version %d with %d byte records, expected version %d with %d\n",
+	     argv[optind], header.version, header.record_size, SPITRACE_VERSION, (int) sizeof(spitrace_record) );
+    return 1;
+  }
+
+  while ( fread( &r, sizeof(r), 1, f ) == 1 ) {
+    if ( r.spichannel >= CHANNELS ) continue;
+    if ( only >= 0 && r.spichannel != only ) continue;
+
+    if ( !count ) first = r.t_ns;
+    else if ( r.t_ns > prev_end && r.t_ns - prev_end > gap ) {
+      gap = r.t_ns - prev_end;
+      gap_at = prev_end;
+    }
+    prev_end = r.t_ns + r.duration_ns;
+    last = prev_end;
+    busy += r.duration_ns;
+
+    if ( count == capacity ) {
+      capacity = capacity ? 2 * capacity : 65536;
+      durations = (uint32_t *) realloc( durations, capacity * sizeof(uint32_t) );
+    }
+    durations[count++] = r.duration_ns;
+    replay( &r, dump, header.start_ns );
+  }
+  fclose( f );
+
+  if ( !count ) {
+    printf( "no transfers\n" );
+    return 0;
+  }
+  qsort( durations, count, sizeof(uint32_t), compare_u32 );
+  span = (last - first) * 1e-9;
+
+  for ( c = 0; c < CHANNELS; c++ )
+    for ( a = 0; a < REGISTERS; a++ ) {
+      writes += model[c][a].writes;
+      reads += model[c][a].reads;
+      redundant += model[c][a].redundant;
+      errors += model[c][a].readback_errors;
+    }
+
+  printf( "%zu transfers over %.3f s, %.0f per second, bus busy %.1f%%\n",
+	  count, span, span > 0 ? count / span : 0, span > 0 ? 100.0 * busy * 1e-9 / span : 0 );
+  printf( "%lu writes (%lu redundant, %.1f%%), %lu reads, %lu DAC read-back mismatches\n",
+	  writes, redundant, writes ? 100.0 * redundant / writes : 0, reads, errors );
+  printf( "transfer time us: min %.1f  median %.1f  p99 %.1f  max %.1f\n",
+	  durations[0] * 1e-3, durations[count / 2] * 1e-3,
+	  durations[count - 1 - count / 100] * 1e-3, durations[count - 1] * 1e-3 );
+  printf( "longest gap %.3f ms at %.3f s\n\n", gap * 1e-6, (gap_at - header.start_ns) * 1e-9 );
+
+  printf( "ch register          writes redundant  reads  rate/s   min-ms  mean-ms   max-ms\n" );
+  for ( c = 0; c < CHANNELS; c++ )
+    for ( a = 0; a < REGISTERS; a++ ) {
+      t_reg_state *s = &model[c][a];
+      char name[32];
+      if ( !s->writes && !s->reads ) continue;
+      printf( "%2d %-16s %8lu %9lu %6lu %7.1f", c, register_name( a, name, sizeof(name) ),
+	      s->writes, s->redundant, s->reads, span > 0 ? s->writes / span : 0 );
+      if ( s->intervals )
+	printf( " %8.3f %8.3f %8.3f", s->min_interval * 1e-6,
+		(double) s->sum_interval / s->intervals * 1e-6, s->max_interval * 1e-6 );
+      if ( s->readback_errors ) printf( "  %lu read-back mismatches", s->readback_errors );
+      printf( "\n" );
+    }
+
+  if ( print_model ) {
+    printf( "\nregister model at the end of the trace:\n" );
+    for ( c = 0; c < CHANNELS; c++ )
+      for ( a = 0; a < REGISTERS; a++ ) {
+	char name[32];
+	if ( !model[c][a].known ) continue;
+	printf( "%2d %-16s 0x%04x %5d\n", c, register_name( a, name, sizeof(name) ),
+		model[c][a].value, model[c][a].value );
+      }
+  }
+
+  free( durations );
+  return 0;
+}
+
+/****************************************************************/
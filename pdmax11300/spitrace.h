@@ -0,0 +1,44 @@
+/// spitrace.h : binary format of the MAX11300 SPI transaction trace
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// The wiringPi external records every register access in a preallocated
+// ring while [spi_trace <file>( is active, and a background thread appends
+// the records to the file.  The file is a spitrace_header followed by
+// spitrace_record entries until the end of the file, in host byte order.
+// spitrace.c reads it back and replays it against a register model.
+
+#ifndef SPITRACE_H
+#define SPITRACE_H
+
+#include <stdint.h>
+
+#define SPITRACE_MAGIC      0x54495053   // 'SPIT'
+#define SPITRACE_VERSION    1
+
+#define SPITRACE_WRITE      0x00
+#define SPITRACE_READ       0x01
+
+/****************************************************************/
+typedef struct spitrace_header
+{
+  uint32_t magic;          ///< SPITRACE_MAGIC
+  uint16_t version;        ///< SPITRACE_VERSION
+  uint16_t record_size;    ///< sizeof(spitrace_record)
+  uint64_t start_ns;       ///< CLOCK_MONOTONIC time the trace was started
+} spitrace_header;
+
+/// One SPI transaction.  The value is the word written, or the word read.
+typedef struct spitrace_record
+{
+  uint64_t t_ns;           ///< CLOCK_MONOTONIC time the transfer started
+  uint32_t duration_ns;    ///< time spent in wiringPiSPIDataRW
+  uint8_t spichannel;
+  uint8_t address;         ///< register address, before the read/write shift
+  uint8_t flags;           ///< SPITRACE_WRITE or SPITRACE_READ
+  uint8_t reserved;
+  uint16_t value;
+  uint16_t reserved2;
+} spitrace_record;
+
+#endif // SPITRACE_H
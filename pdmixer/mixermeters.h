@@ -0,0 +1,60 @@
+/// mixermeters.h : meter snapshot published by the sy79 [mixer~] external
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// [mixer~] updates one snapshot of bus meters per DSP block.  The snapshot
+// lives either inside the object or, after [meters_shm <name>(, in a POSIX
+// shared memory object so that a GUI or LCD process can map it and read it
+// at its own rate without ever blocking the audio thread.
+//
+// There is exactly one writer, the DSP routine, so the sequence counter is
+// simply made odd before the update and even after it; a reader retries
+// whenever it saw an odd counter or the counter changed under it.
+
+#ifndef MIXERMETERS_H
+#define MIXERMETERS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define MIXER_METERS_MAGIC      0x6d657472   // 'metr'
+#define MIXER_MAX_BUSES         16
+
+/****************************************************************/
+/// Meter values are linear amplitudes, 1.0 being full scale.
+typedef struct mixer_meters
+{
+  uint32_t magic;                      ///< MIXER_METERS_MAGIC once initialized
+  uint32_t seq;                        ///< seqlock counter, odd while being written
+  uint32_t buses;                      ///< number of valid entries below
+  uint32_t blocks;                     ///< DSP blocks processed, shows the mixer is alive
+  float peak[MIXER_MAX_BUSES];         ///< peak with a slow release
+  float rms[MIXER_MAX_BUSES];          ///< RMS over roughly the last 300 ms
+} mixer_meters;
+
+/****************************************************************/
+// Seqlock helpers.  mixer_meters_begin/end bracket the writer's update.
+
+static inline void mixer_meters_begin( mixer_meters *m )
+{
+  __atomic_store_n( &m->seq, m->seq + 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+static inline void mixer_meters_end( mixer_meters *m )
+{
+  __atomic_store_n( &m->seq, m->seq + 1, __ATOMIC_RELEASE );
+}
+
+static inline void mixer_meters_read( mixer_meters *m, mixer_meters *copy )
+{
+  uint32_t before, after;
+  do {
+    before = __atomic_load_n( &m->seq, __ATOMIC_ACQUIRE );
+    memcpy( copy, (const void *) m, sizeof(mixer_meters) );
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    after  = __atomic_load_n( &m->seq, __ATOMIC_RELAXED );
+  } while ( (before & 1) || before != after );
+}
+
+#endif // MIXERMETERS_H
@@ -0,0 +1,403 @@
+/// pdmixer.c : Pd external for the output mixer feeding the eight JACK outputs
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+//   POSIX shm:         http://man7.org/linux/man-pages/man7/shm_overview.7.html
+
+// [mixer~] replaces the per-channel *~ and vsl faders of 8channelmixer.pd and
+// outputsdummy.pd.  Every input reaches every bus through a send level; the
+// effective gain of each input/bus pair is its send times the channel fader
+// and the bus master, with mutes folded in.  Whenever one of those changes the
+// pair ramps to its new gain sample by sample over the ramp time, so fader
+// moves and mutes do not zipper or click.
+//
+// The mix is accumulated into scratch buses in one pass over the inputs, one
+// multiply-add loop per active pair, and copied to the outlets afterwards
+// since Pd may let outlets share buffers with inlets.  Each block also updates
+// the bus meters in a lock-free snapshot, see mixermeters.h.  Build like the
+// wiringPi external and link with -lrt.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#include "mixermeters.h"
+
+#define MIXER_MAX_INPUTS   16
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'mixer~' object.
+typedef struct pdmixer
+{
+  t_object x_ob;           ///< standard object header
+  t_float x_f;             ///< main signal inlet scalar
+  t_outlet *x_meter_out;   ///< peak and rms lists in dBFS
+  t_clock *x_clock;        ///< reports the meters at meter_rate
+  double meter_ms;         ///< report period, 0 when not reporting
+  float sr;                ///< sample rate of the DSP chain
+
+  int inputs, buses;
+  t_sample *in[MIXER_MAX_INPUTS];
+  t_sample *out[MIXER_MAX_BUSES];
+  float *mix;              ///< scratch, buses * block samples
+  int mix_size;
+
+  // mixer settings, combined into target gains by update_targets
+  float fader[MIXER_MAX_INPUTS];
+  char mute[MIXER_MAX_INPUTS];
+  float send[MIXER_MAX_INPUTS][MIXER_MAX_BUSES];
+  float master[MIXER_MAX_BUSES];
+  char bus_mute[MIXER_MAX_BUSES];
+
+  // per pair gain ramps
+  float ramp_ms;
+  int ramp_samples;
+  float gain[MIXER_MAX_INPUTS][MIXER_MAX_BUSES];     ///< gain at the start of the next block
+  float target[MIXER_MAX_INPUTS][MIXER_MAX_BUSES];
+  float step[MIXER_MAX_INPUTS][MIXER_MAX_BUSES];     ///< gain change per sample while ramping
+  int remain[MIXER_MAX_INPUTS][MIXER_MAX_BUSES];     ///< samples left in the ramp
+
+  // meters
+  float peak_release;      ///< peak decay per block
+  float rms_coef;          ///< one pole coefficient for the mean square, per block
+  float peak[MIXER_MAX_BUSES];
+  float mean_square[MIXER_MAX_BUSES];
+  mixer_meters local;      ///< snapshot when not exported
+  mixer_meters *meters;    ///< &local or the shared memory mapping
+} t_pdmixer;
+
+static t_class *pdmixer_class;
+
+/****************************************************************/
+// Fold faders, sends, masters and mutes into a target per input/bus pair and
+// start a ramp for every pair whose target moved.
+static void update_targets( t_pdmixer *x )
+{
+  int i, b;
+  for ( i = 0; i < x->inputs; i++ ) {
+    for ( b = 0; b < x->buses; b++ ) {
+      float t = x->fader[i] * x->send[i][b] * x->master[b];
+      if ( x->mute[i] || x->bus_mute[b] ) t = 0;
+      if ( t == x->target[i][b] ) continue;
+      x->target[i][b] = t;
+      if ( x->ramp_samples > 0 ) {
+	x->remain[i][b] = x->ramp_samples;
+	x->step[i][b] = (t - x->gain[i][b]) / x->ramp_samples;
+      } else {
+	x->gain[i][b] = t;
+	x->remain[i][b] = 0;
+      }
+    }
+  }
+}
+
+/****************************************************************/
+// Add one input into one bus.  The ramp part and the flat part are separate
+// loops so that both stay simple multiply-adds the compiler can vectorize.
+static inline void accumulate( t_pdmixer *x, int i, int b, const t_sample *in, float *acc, int n )
+{
+  float g = x->gain[i][b];
+  int k = 0, s;
+
+  if ( x->remain[i][b] > 0 ) {
+    float step = x->step[i][b];
+    k = (x->remain[i][b] < n) ? x->remain[i][b] : n;
+    for ( s = 0; s < k; s++ ) acc[s] += in[s] * (g + step * s);
+    x->remain[i][b] -= k;
+    g = x->remain[i][b] ? g + step * k : x->target[i][b];
+    x->gain[i][b] = g;
+  }
+  if ( g != 0 )
+    for ( s = k; s < n; s++ ) acc[s] += in[s] * g;
+}
+
+/****************************************************************/
+static t_int *pdmixer_perform( t_int *w )
+{
+  t_pdmixer *x = (t_pdmixer *) w[1];
+  int n = (int) w[2], i, b, s;
+  mixer_meters *m = x->meters;
+
+  memset( x->mix, 0, x->buses * n * sizeof(float) );
+  for ( i = 0; i < x->inputs; i++ )
+    for ( b = 0; b < x->buses; b++ )
+      if ( x->gain[i][b] != 0 || x->remain[i][b] > 0 )
+	accumulate( x, i, b, x->in[i], x->mix + b * n, n );
+
+  mixer_meters_begin( m );
+  for ( b = 0; b < x->buses; b++ ) {
+    const float *acc = x->mix + b * n;
+    t_sample *out = x->out[b];
+    float peak = 0, sum = 0;
+    for ( s = 0; s < n; s++ ) {
+      float v = acc[s];
+      float a = fabsf( v );
+      peak = (a > peak) ? a : peak;
+      sum += v * v;
+      out[s] = v;
+    }
+    x->peak[b] *= x->peak_release;
+    if ( peak > x->peak[b] ) x->peak[b] = peak;
+    x->mean_square[b] += x->rms_coef * (sum / n - x->mean_square[b]);
+    m->peak[b] = x->peak[b];
+    m->rms[b] = sqrtf( x->mean_square[b] );
+  }
+  m->blocks++;
+  mixer_meters_end( m );
+  return w + 3;
+}
+
+static void pdmixer_dsp( t_pdmixer *x, t_signal **sp )
+{
+  int n = sp[0]->s_n, i;
+  float blocks_per_second;
+
+  x->sr = sp[0]->s_sr;
+  for ( i = 0; i < x->inputs; i++ ) x->in[i] = sp[i]->s_vec;
+  for ( i = 0; i < x->buses; i++ ) x->out[i] = sp[x->inputs + i]->s_vec;
+
+  if ( x->mix_size != x->buses * n ) {
+    if ( x->mix ) freebytes( x->mix, x->mix_size * sizeof(float) );
+    x->mix_size = x->buses * n;
+    x->mix = (float *) getbytes( x->mix_size * sizeof(float) );
+  }
+
+  // about 20 dB per second of peak release and a 300 ms RMS window
+  blocks_per_second = x->sr / n;
+  x->peak_release = powf( 10.0f, -1.0f / blocks_per_second );
+  x->rms_coef = 1.0f - expf( -1.0f / (0.3f * blocks_per_second) );
+  x->ramp_samples = (int)( x->ramp_ms * 0.001f * x->sr );
+
+  dsp_add( pdmixer_perform, 2, x, (t_int) n );
+}
+
+/****************************************************************/
+static inline int valid_input( t_pdmixer *x, int i )
+{
+  if ( i >= 0 && i < x->inputs ) return 1;
+  post("mixer~: input %d out of range 0 to %d.", i, x->inputs - 1 );
+  return 0;
+}
+
+static inline int valid_bus( t_pdmixer *x, int b )
+{
+  if ( b >= 0 && b < x->buses ) return 1;
+  post("mixer~: bus %d out of range 0 to %d.", b, x->buses - 1 );
+  return 0;
+}
+
+//  [ gain <input> <gain> ]  channel fader, linear
+static void pdmixer_gain( t_pdmixer *x, t_floatarg in, t_floatarg g )
+{
+  if ( !valid_input( x, (int) in )) return;
+  x->fader[(int) in] = g;
+  update_targets( x );
+}
+
+//  [ send <input> <bus> <level> ]  how much of an input reaches a bus
+static void pdmixer_send( t_pdmixer *x, t_floatarg in, t_floatarg bus, t_floatarg level )
+{
+  if ( !valid_input( x, (int) in ) || !valid_bus( x, (int) bus )) return;
+  x->send[(int) in][(int) bus] = level;
+  update_targets( x );
+}
+
+//  [ mute <input> <0|1> ]
+static void pdmixer_mute( t_pdmixer *x, t_floatarg in, t_floatarg on )
+{
+  if ( !valid_input( x, (int) in )) return;
+  x->mute[(int) in] = (on != 0);
+  update_targets( x );
+}
+
+//  [ master <bus> <gain> ]
+static void pdmixer_master( t_pdmixer *x, t_floatarg bus, t_floatarg g )
+{
+  if ( !valid_bus( x, (int) bus )) return;
+  x->master[(int) bus] = g;
+  update_targets( x );
+}
+
+//  [ bus_mute <bus> <0|1> ]
+static void pdmixer_bus_mute( t_pdmixer *x, t_floatarg bus, t_floatarg on )
+{
+  if ( !valid_bus( x, (int) bus )) return;
+  x->bus_mute[(int) bus] = (on != 0);
+  update_targets( x );
+}
+
+//  [ ramp <ms> ]  time for any gain change, 20 ms by default
+static void pdmixer_ramp( t_pdmixer *x, t_floatarg ms )
+{
+  x->ramp_ms = (ms > 0) ? ms : 0;
+  x->ramp_samples = (int)( x->ramp_ms * 0.001f * x->sr );
+}
+
+/****************************************************************/
+// Report the meters from the snapshot, in dBFS with a floor at -100.
+static void pdmixer_tick( t_pdmixer *x )
+{
+  mixer_meters copy;
+  t_atom list[MIXER_MAX_BUSES];
+  int b;
+
+  mixer_meters_read( x->meters, &copy );
+  for ( b = 0; b < x->buses; b++ )
+    SETFLOAT( &list[b], copy.peak[b] > 1e-5f ? 20.0f * log10f( copy.peak[b] ) : -100.0f );
+  outlet_anything( x->x_meter_out, gensym("peak"), x->buses, list );
+  for ( b = 0; b < x->buses; b++ )
+    SETFLOAT( &list[b], copy.rms[b] > 1e-5f ? 20.0f * log10f( copy.rms[b] ) : -100.0f );
+  outlet_anything( x->x_meter_out, gensym("rms"), x->buses, list );
+
+  if ( x->meter_ms > 0 ) clock_delay( x->x_clock, x->meter_ms );
+}
+
+//  [ meter_rate <hz> ]  report the meters on the right outlet, 0 stops
+static void pdmixer_meter_rate( t_pdmixer *x, t_floatarg hz )
+{
+  x->meter_ms = (hz > 0) ? 1000.0 / hz : 0;
+  if ( x->meter_ms > 0 ) clock_delay( x->x_clock, 0 );
+  else clock_unset( x->x_clock );
+}
+
+/****************************************************************/
+static void unmap_meters( t_pdmixer *x )
+{
+  if ( x->meters != &x->local ) {
+    munmap( x->meters, sizeof(mixer_meters) );
+    x->meters = &x->local;
+  }
+}
+
+//  [ meters_shm <name> ]  publish the meter snapshot in shared memory
+static void pdmixer_meters_shm( t_pdmixer *x, t_symbol *name )
+{
+  int fd;
+  void *mem;
+  mixer_meters *m;
+
+  unmap_meters( x );
+  fd = shm_open( name->s_name, O_RDWR | O_CREAT, 0666 );
+  if ( fd < 0 ) {
+    post("mixer~: shm_open %s returned error %d.", name->s_name, errno );
+    return;
+  }
+  if ( ftruncate( fd, sizeof(mixer_meters) ) < 0 ) {
+    post("mixer~: ftruncate %s returned error %d.", name->s_name, errno );
+    close( fd );
+    return;
+  }
+  mem = mmap( NULL, sizeof(mixer_meters), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( mem == MAP_FAILED ) {
+    post("mixer~: mmap %s returned error %d.", name->s_name, errno );
+    return;
+  }
+
+  m = (mixer_meters *) mem;
+  memcpy( m, &x->local, sizeof(mixer_meters) );
+  m->seq = 0;
+  m->magic = MIXER_METERS_MAGIC;
+  x->meters = m;
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'mixer~' object.
+///
+///  [ mixer~ [inputs] [buses] ]  8 and 8 by default; input n goes to bus n
+///  inlets: one signal per input;  outlets: one signal per bus, then meters
+static void *pdmixer_new( t_floatarg inputs, t_floatarg buses )
+{
+  t_pdmixer *x = (t_pdmixer *) pd_new(pdmixer_class);
+  int i, b;
+
+  x->inputs = (inputs >= 1) ? (int) inputs : 8;
+  x->buses = (buses >= 1) ? (int) buses : 8;
+  if ( x->inputs > MIXER_MAX_INPUTS ) x->inputs = MIXER_MAX_INPUTS;
+  if ( x->buses > MIXER_MAX_BUSES ) x->buses = MIXER_MAX_BUSES;
+  x->x_f = 0;
+  x->sr = sys_getsr();
+  x->mix = NULL;
+  x->mix_size = 0;
+  x->meter_ms = 0;
+
+  for ( i = 0; i < x->inputs; i++ ) {
+    x->fader[i] = 1;
+    x->mute[i] = 0;
+    for ( b = 0; b < x->buses; b++ ) {
+      x->send[i][b] = (i == b) ? 1 : 0;
+      x->gain[i][b] = x->target[i][b] = x->send[i][b];
+      x->step[i][b] = 0;
+      x->remain[i][b] = 0;
+    }
+  }
+  for ( b = 0; b < x->buses; b++ ) {
+    x->master[b] = 1;
+    x->bus_mute[b] = 0;
+    x->peak[b] = x->mean_square[b] = 0;
+  }
+  pdmixer_ramp( x, 20 );
+  x->peak_release = 0.9f;
+  x->rms_coef = 0.1f;
+
+  memset( &x->local, 0, sizeof(x->local) );
+  x->local.magic = MIXER_METERS_MAGIC;
+  x->local.buses = x->buses;
+  x->meters = &x->local;
+
+  for ( i = 1; i < x->inputs; i++ ) inlet_new( &x->x_ob, &x->x_ob.ob_pd, &s_signal, &s_signal );
+  for ( b = 0; b < x->buses; b++ ) outlet_new( &x->x_ob, &s_signal );
+  x->x_meter_out = outlet_new( &x->x_ob, NULL );
+  x->x_clock = clock_new( x, (t_method) pdmixer_tick );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Release an instance of a Pd 'mixer~' object.  A shared memory snapshot is
+/// left in place for readers, its blocks counter simply stops.
+static void pdmixer_free( t_pdmixer *x )
+{
+  clock_free( x->x_clock );
+  unmap_meters( x );
+  if ( x->mix ) freebytes( x->mix, x->mix_size * sizeof(float) );
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'mixer~' external.
+void mixer_tilde_setup(void)
+{
+  pdmixer_class = class_new( gensym("mixer~"),
+			     (t_newmethod) pdmixer_new,
+			     (t_method) pdmixer_free,
+			     sizeof(t_pdmixer),
+			     0,
+			     A_DEFFLOAT, A_DEFFLOAT, 0);
+
+  CLASS_MAINSIGNALIN( pdmixer_class, t_pdmixer, x_f );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_dsp, gensym("dsp"), A_CANT, 0 );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_gain, gensym("gain"), A_FLOAT, A_FLOAT, 0 );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_send, gensym("send"), A_FLOAT, A_FLOAT, A_FLOAT, 0 );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_mute, gensym("mute"), A_FLOAT, A_FLOAT, 0 );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_master, gensym("master"), A_FLOAT, A_FLOAT, 0 );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_bus_mute, gensym("bus_mute"), A_FLOAT, A_FLOAT, 0 );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_ramp, gensym("ramp"), A_FLOAT, 0 );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_meter_rate, gensym("meter_rate"), A_FLOAT, 0 );
+  class_addmethod( pdmixer_class, (t_method) pdmixer_meters_shm, gensym("meters_shm"), A_SYMBOL, 0 );
+}
+
+/****************************************************************/
@@ -0,0 +1,263 @@
+/// pdmodmatrix.c : Pd external sparse modulation matrix
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+
+// [modmatrix~] replaces the fixed *~ and +~ graphs behind the 36 matrix
+// slots of the 6op presets and the pmod/fmod/amod routings of lfosy77.pd.
+// Every destination is the sum of the sources scaled by their route amounts,
+// but most amounts are zero in most presets, so only the non-zero routes are
+// kept in a compact list which is rebuilt when an amount changes.  The DSP
+// routine walks that list once per block with one multiply-add loop per
+// route, so the cost follows the number of routes in use rather than
+// sources times destinations.
+//
+// An amount change ramps across one block.  A route set to zero stays in the
+// list until its ramp has reached zero and is dropped afterwards.
+//
+// Sources are signals plus an optional control value; destinations are
+// signals, and a bang reports their latest values as a list for control
+// rate use.  As in [mixer~], the sums are formed in scratch buffers and
+// copied to the outlets last since Pd may let outlets share inlet buffers.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define MODMATRIX_MAX   16           ///< sources and destinations
+
+/****************************************************************/
+/// One active route.
+typedef struct modmatrix_route
+{
+  int src, dst;
+} t_modmatrix_route;
+
+/// Data structure to hold the state of a single Pd 'modmatrix~' object.
+typedef struct pdmodmatrix
+{
+  t_object x_ob;           ///< standard object header
+  t_float x_f;             ///< main signal inlet scalar
+  t_outlet *x_value_out;   ///< destination values for control rate use
+
+  int sources, dests;
+  t_sample *in[MODMATRIX_MAX];
+  t_sample *out[MODMATRIX_MAX];
+  float *mix;              ///< scratch, dests * block samples
+  int mix_size;
+
+  float amount[MODMATRIX_MAX][MODMATRIX_MAX];    ///< route amounts by source and destination
+  float gain[MODMATRIX_MAX][MODMATRIX_MAX];      ///< amount reached at the start of the next block
+  float offset[MODMATRIX_MAX];                   ///< control value added to each source
+  float value[MODMATRIX_MAX];                    ///< last sample of each destination
+
+  t_modmatrix_route route[MODMATRIX_MAX * MODMATRIX_MAX];   ///< active routes grouped by destination
+  int routes;
+  int stale;               ///< a route finished ramping to zero, rebuild after the block
+} t_pdmodmatrix;
+
+static t_class *pdmodmatrix_class;
+
+/****************************************************************/
+// Collect the routes with an amount, or still ramping away from one.
+static void rebuild_routes( t_pdmodmatrix *x )
+{
+  int s, d, n = 0;
+  for ( d = 0; d < x->dests; d++ )
+    for ( s = 0; s < x->sources; s++ )
+      if ( x->amount[s][d] != 0 || x->gain[s][d] != 0 ) {
+	x->route[n].src = s;
+	x->route[n].dst = d;
+	n++;
+      }
+  x->routes = n;
+  x->stale = 0;
+}
+
+/****************************************************************/
+// Add one source into one destination.  The ramp and the flat case are
+// separate loops so that both stay simple multiply-adds the compiler can
+// vectorize.
+static inline void accumulate( t_pdmodmatrix *x, int src, int dst, float *acc, int n )
+{
+  const t_sample *in = x->in[src];
+  float g = x->gain[src][dst], target = x->amount[src][dst], off = x->offset[src];
+  int i;
+
+  if ( g != target ) {
+    float step = (target - g) / n;
+    for ( i = 0; i < n; i++ ) acc[i] += (in[i] + off) * (g + step * i);
+    x->gain[src][dst] = target;
+    if ( target == 0 ) x->stale = 1;
+  } else {
+    for ( i = 0; i < n; i++ ) acc[i] += (in[i] + off) * g;
+  }
+}
+
+/****************************************************************/
+static t_int *pdmodmatrix_perform( t_int *w )
+{
+  t_pdmodmatrix *x = (t_pdmodmatrix *) w[1];
+  int n = (int) w[2], r, d;
+  int used[MODMATRIX_MAX];
+
+  memset( used, 0, sizeof(used) );
+  for ( r = 0; r < x->routes; r++ ) {
+    t_modmatrix_route *route = &x->route[r];
+    float *acc = x->mix + route->dst * n;
+    if ( !used[route->dst] ) {
+      memset( acc, 0, n * sizeof(float) );
+      used[route->dst] = 1;
+    }
+    accumulate( x, route->src, route->dst, acc, n );
+  }
+
+  for ( d = 0; d < x->dests; d++ ) {
+    if ( used[d] ) {
+      memcpy( x->out[d], x->mix + d * n, n * sizeof(t_sample) );
+      x->value[d] = x->out[d][n - 1];
+    } else {
+      memset( x->out[d], 0, n * sizeof(t_sample) );
+      x->value[d] = 0;
+    }
+  }
+
+  if ( x->stale ) rebuild_routes( x );
+  return w + 3;
+}
+
+static void pdmodmatrix_dsp( t_pdmodmatrix *x, t_signal **sp )
+{
+  int n = sp[0]->s_n, i;
+
+  for ( i = 0; i < x->sources; i++ ) x->in[i] = sp[i]->s_vec;
+  for ( i = 0; i < x->dests; i++ ) x->out[i] = sp[x->sources + i]->s_vec;
+
+  if ( x->mix_size != x->dests * n ) {
+    if ( x->mix ) freebytes( x->mix, x->mix_size * sizeof(float) );
+    x->mix_size = x->dests * n;
+    x->mix = (float *) getbytes( x->mix_size * sizeof(float) );
+  }
+  dsp_add( pdmodmatrix_perform, 2, x, (t_int) n );
+}
+
+/****************************************************************/
+static inline int valid_route( t_pdmodmatrix *x, int s, int d )
+{
+  if ( s >= 0 && s < x->sources && d >= 0 && d < x->dests ) return 1;
+  post("modmatrix~: route %d %d out of range.", s, d );
+  return 0;
+}
+
+//  [ amount <source> <destination> <amount> ]
+static void pdmodmatrix_amount( t_pdmodmatrix *x, t_floatarg s, t_floatarg d, t_floatarg amount )
+{
+  if ( !valid_route( x, (int) s, (int) d )) return;
+  if ( x->amount[(int) s][(int) d] == amount ) return;
+  x->amount[(int) s][(int) d] = amount;
+  rebuild_routes( x );
+}
+
+//  [ matrix <amounts...> ]  all amounts, one row of destinations per source,
+//  e.g. the 36 matrix slots of a 6op preset for [modmatrix~ 6 6]
+static void pdmodmatrix_matrix( t_pdmodmatrix *x, t_symbol *sel, int argcount, t_atom *argvec )
+{
+  int s, d, i = 0;
+  for ( s = 0; s < x->sources; s++ )
+    for ( d = 0; d < x->dests; d++, i++ )
+      x->amount[s][d] = (i < argcount) ? atom_getfloat( &argvec[i] ) : 0;
+  rebuild_routes( x );
+}
+
+//  [ clear ]  set all amounts to zero
+static void pdmodmatrix_clear( t_pdmodmatrix *x )
+{
+  memset( x->amount, 0, sizeof(x->amount) );
+  rebuild_routes( x );
+}
+
+//  [ value <source> <value> ]  control rate source, added to its signal
+static void pdmodmatrix_value( t_pdmodmatrix *x, t_floatarg s, t_floatarg value )
+{
+  if ( s < 0 || s >= x->sources ) {
+    post("modmatrix~: source %d out of range 0 to %d.", (int) s, x->sources - 1 );
+    return;
+  }
+  x->offset[(int) s] = value;
+}
+
+/// A bang sends the last value of every destination as a list.
+static void pdmodmatrix_bang( t_pdmodmatrix *x )
+{
+  t_atom a[MODMATRIX_MAX];
+  int d;
+  for ( d = 0; d < x->dests; d++ ) SETFLOAT( &a[d], x->value[d] );
+  outlet_list( x->x_value_out, &s_list, x->dests, a );
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'modmatrix~' object.
+///
+///  [ modmatrix~ [sources] [destinations] ]  4 and 4 by default, all routes off
+///  inlets: one signal per source;  outlets: one signal per destination, then values
+static void *pdmodmatrix_new( t_floatarg sources, t_floatarg dests )
+{
+  t_pdmodmatrix *x = (t_pdmodmatrix *) pd_new(pdmodmatrix_class);
+  int i;
+
+  x->sources = (sources >= 1) ? (int) sources : 4;
+  x->dests = (dests >= 1) ? (int) dests : 4;
+  if ( x->sources > MODMATRIX_MAX ) x->sources = MODMATRIX_MAX;
+  if ( x->dests > MODMATRIX_MAX ) x->dests = MODMATRIX_MAX;
+  x->x_f = 0;
+  x->mix = NULL;
+  x->mix_size = 0;
+
+  memset( x->amount, 0, sizeof(x->amount) );
+  memset( x->gain, 0, sizeof(x->gain) );
+  memset( x->offset, 0, sizeof(x->offset) );
+  memset( x->value, 0, sizeof(x->value) );
+  rebuild_routes( x );
+
+  for ( i = 1; i < x->sources; i++ ) inlet_new( &x->x_ob, &x->x_ob.ob_pd, &s_signal, &s_signal );
+  for ( i = 0; i < x->dests; i++ ) outlet_new( &x->x_ob, &s_signal );
+  x->x_value_out = outlet_new( &x->x_ob, &s_list );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Release an instance of a Pd 'modmatrix~' object.
+static void pdmodmatrix_free( t_pdmodmatrix *x )
+{
+  if ( x->mix ) freebytes( x->mix, x->mix_size * sizeof(float) );
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'modmatrix~' external.
+void modmatrix_tilde_setup(void)
+{
+  pdmodmatrix_class = class_new( gensym("modmatrix~"),
+				 (t_newmethod) pdmodmatrix_new,
+				 (t_method) pdmodmatrix_free,
+				 sizeof(t_pdmodmatrix),
+				 0,
+				 A_DEFFLOAT, A_DEFFLOAT, 0);
+
+  CLASS_MAINSIGNALIN( pdmodmatrix_class, t_pdmodmatrix, x_f );
+  class_addmethod( pdmodmatrix_class, (t_method) pdmodmatrix_dsp, gensym("dsp"), A_CANT, 0 );
+  class_addbang( pdmodmatrix_class, pdmodmatrix_bang );
+  class_addmethod( pdmodmatrix_class, (t_method) pdmodmatrix_amount, gensym("amount"), A_FLOAT, A_FLOAT, A_FLOAT, 0 );
+  class_addmethod( pdmodmatrix_class, (t_method) pdmodmatrix_matrix, gensym("matrix"), A_GIMME, 0 );
+  class_addmethod( pdmodmatrix_class, (t_method) pdmodmatrix_clear, gensym("clear"), 0 );
+  class_addmethod( pdmodmatrix_class, (t_method) pdmodmatrix_value, gensym("value"), A_FLOAT, A_FLOAT, 0 );
+}
+
+/****************************************************************/
@@ -0,0 +1,325 @@
+/// pdmorph.c : Pd external for a morphing wavetable oscillator with a frame cache
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+
+// [morph~] replaces the expr~ region selectors and *~ blends of wave_morph.pd.
+// The source tables (array-1 .. array-4 there, up to eight here) are analysed
+// into harmonics when they are set or updated, and a dense cache of frames is
+// built along the morph axis: FRAMES_PER_SEGMENT frames between each pair of
+// neighbouring sources, each interpolating harmonic magnitude and phase, so a
+// morph does not pass through the comb-filtered dips of a plain crossfade.
+//
+// Every frame is stored at MORPH_MIPS band limits, each holding half the
+// harmonics of the one before.  Playback picks the band limit once per block
+// from the highest frequency in it, then reads the cache bilinearly: along
+// the waveform and between the two nearest frames.
+//
+// Pd has no notification when an array is redrawn, so after changing a
+// source table (e.g. with sinesum) send [update( to rebuild the cache.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define MORPH_TABLE          512      ///< points per cached frame, a power of two
+#define MORPH_HARMONICS      (MORPH_TABLE / 2 - 1)
+#define MORPH_MIPS           9        ///< 255, 128, 64 ... 1 harmonics
+#define MORPH_MAX_SOURCES    8
+#define FRAMES_PER_SEGMENT   8
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'morph~' object.
+typedef struct pdmorph
+{
+  t_object x_ob;           ///< standard object header
+  t_float x_f;             ///< main signal inlet scalar, frequency in Hz
+  float sr;                ///< sample rate of the DSP chain
+  double phase;            ///< oscillator phase in cycles
+
+  int sources;             ///< number of source tables
+  t_symbol *source[MORPH_MAX_SOURCES];
+  int frames;              ///< frames along the morph axis
+  float *cache;            ///< [mip][frame][MORPH_TABLE + 1], the last point wraps
+} t_pdmorph;
+
+static t_class *pdmorph_class;
+static float costab[MORPH_TABLE];
+
+/****************************************************************/
+static inline int harmonics_at( int mip )
+{
+  int h = (MORPH_TABLE / 2) >> mip;
+  return (h > MORPH_HARMONICS) ? MORPH_HARMONICS : h;
+}
+
+static inline float *frame_at( t_pdmorph *x, int mip, int frame )
+{
+  return x->cache + ((size_t) mip * x->frames + frame) * (MORPH_TABLE + 1);
+}
+
+/****************************************************************/
+// Read one source into MORPH_TABLE points and take its harmonics.  Tables
+// from sinesum carry one guard point before and two after the period, as
+// tabread4~ expects; any other size is taken as one whole period.
+static void analyse_source( t_pdmorph *x, t_symbol *name, float *mag, float *ph )
+{
+  float wave[MORPH_TABLE];
+  t_garray *a;
+  t_word *vec;
+  int size, i, k;
+
+  memset( wave, 0, sizeof(wave) );
+  if ( !(a = (t_garray *) pd_findbyclass( name, garray_class ))) {
+    pd_error( x, "morph~: %s: no such array", name->s_name );
+  } else if ( !garray_getfloatwords( a, &size, &vec ) || size < 4 ) {
+    pd_error( x, "morph~: %s: bad template or too short", name->s_name );
+  } else {
+    int first = 0, period = size;
+    if ( size > 3 && !((size - 3) & (size - 4)) ) {
+      first = 1;
+      period = size - 3;
+    }
+    for ( i = 0; i < MORPH_TABLE; i++ ) {
+      double pos = (double) i * period / MORPH_TABLE;
+      int j = (int) pos;
+      float frac = pos - j;
+      float a0 = vec[first + j].w_float;
+      float a1 = vec[first + (j + 1) % period].w_float;
+      wave[i] = a0 + frac * (a1 - a0);
+    }
+  }
+
+  for ( k = 1; k <= MORPH_HARMONICS; k++ ) {
+    float re = 0, im = 0;
+    for ( i = 0; i < MORPH_TABLE; i++ ) {
+      re += wave[i] * costab[(k * i) & (MORPH_TABLE - 1)];
+      im += wave[i] * costab[(k * i - MORPH_TABLE / 4) & (MORPH_TABLE - 1)];
+    }
+    re *= 2.0f / MORPH_TABLE;
+    im *= 2.0f / MORPH_TABLE;
+    mag[k] = sqrtf( re * re + im * im );
+    ph[k] = atan2f( im, re );
+  }
+}
+
+/****************************************************************/
+// Synthesize one frame at every band limit.  The levels are nested, so the
+// waveform is built from the fundamental up and stored each time a level's
+// harmonic count is reached.
+static void synthesize_frame( t_pdmorph *x, int frame, const float *mag, const float *ph )
+{
+  float wave[MORPH_TABLE];
+  int i, k = 1, mip;
+
+  memset( wave, 0, sizeof(wave) );
+  for ( mip = MORPH_MIPS - 1; mip >= 0; mip-- ) {
+    float *dest = frame_at( x, mip, frame );
+    for ( ; k <= harmonics_at( mip ); k++ ) {
+      float c = mag[k] * cosf( ph[k] ), s = mag[k] * sinf( ph[k] );
+      if ( mag[k] == 0 ) continue;
+      for ( i = 0; i < MORPH_TABLE; i++ )
+	wave[i] += c * costab[(k * i) & (MORPH_TABLE - 1)]
+	  + s * costab[(k * i - MORPH_TABLE / 4) & (MORPH_TABLE - 1)];
+    }
+    memcpy( dest, wave, sizeof(wave) );
+    dest[MORPH_TABLE] = wave[0];
+  }
+}
+
+/****************************************************************/
+// Rebuild the whole cache from the current source tables.
+static void build_cache( t_pdmorph *x )
+{
+  float mag[MORPH_MAX_SOURCES][MORPH_HARMONICS + 1];
+  float ph[MORPH_MAX_SOURCES][MORPH_HARMONICS + 1];
+  float fmag[MORPH_HARMONICS + 1], fph[MORPH_HARMONICS + 1];
+  int frames = (x->sources - 1) * FRAMES_PER_SEGMENT + 1;
+  int s, f, k;
+
+  if ( x->sources < 1 ) return;
+  if ( frames != x->frames || !x->cache ) {
+    if ( x->cache )
+      freebytes( x->cache, (size_t) MORPH_MIPS * x->frames * (MORPH_TABLE + 1) * sizeof(float) );
+    x->frames = frames;
+    x->cache = (float *) getbytes( (size_t) MORPH_MIPS * frames * (MORPH_TABLE + 1) * sizeof(float) );
+  }
+
+  for ( s = 0; s < x->sources; s++ ) analyse_source( x, x->source[s], mag[s], ph[s] );
+
+  for ( f = 0; f < frames; f++ ) {
+    int s0 = f / FRAMES_PER_SEGMENT;
+    float t = (float)(f % FRAMES_PER_SEGMENT) / FRAMES_PER_SEGMENT;
+    int s1 = (s0 + 1 < x->sources) ? s0 + 1 : s0;
+    for ( k = 1; k <= MORPH_HARMONICS; k++ ) {
+      // take the shorter way round the circle between the two phases, and
+      // the phase of whichever side has a partial when the other is silent
+      float a = ph[s0][k], d = ph[s1][k] - a;
+      if ( d > (float) M_PI ) d -= 2.0f * (float) M_PI;
+      if ( d < -(float) M_PI ) d += 2.0f * (float) M_PI;
+      if ( mag[s0][k] == 0 ) { a = ph[s1][k]; d = 0; }
+      else if ( mag[s1][k] == 0 ) d = 0;
+      fmag[k] = mag[s0][k] + t * (mag[s1][k] - mag[s0][k]);
+      fph[k] = a + t * d;
+    }
+    synthesize_frame( x, f, fmag, fph );
+  }
+}
+
+/****************************************************************/
+static t_int *pdmorph_perform( t_int *w )
+{
+  t_pdmorph *x = (t_pdmorph *) w[1];
+  t_sample *freq  = (t_sample *) w[2];
+  t_sample *morph = (t_sample *) w[3];
+  t_sample *out   = (t_sample *) w[4];
+  int n = (int) w[5], i, mip = 0;
+  double phase = x->phase;
+  float inv_sr = 1.0f / x->sr, fmax = 0, limit;
+  float top = (float)(x->frames - 1);
+  float *base;
+  size_t stride = MORPH_TABLE + 1;
+
+  if ( !x->cache ) {
+    memset( out, 0, n * sizeof(t_sample) );
+    return w + 6;
+  }
+
+  // one band limit for the block, from the highest frequency in it
+  for ( i = 0; i < n; i++ ) if ( fabsf( freq[i] ) > fmax ) fmax = fabsf( freq[i] );
+  limit = (fmax > 0) ? 0.5f * x->sr / fmax : MORPH_HARMONICS;
+  while ( mip < MORPH_MIPS - 1 && harmonics_at( mip ) > limit ) mip++;
+  base = frame_at( x, mip, 0 );
+
+  for ( i = 0; i < n; i++ ) {
+    float m = morph[i] * FRAMES_PER_SEGMENT, fm, fp;
+    float *a, *b, va, vb;
+    double pos;
+    int f0, j;
+
+    phase += freq[i] * inv_sr;
+    phase -= floor( phase );
+
+    if ( m < 0 ) m = 0;
+    if ( m > top ) m = top;
+    f0 = (int) m;
+    if ( f0 >= x->frames - 1 ) f0 = (x->frames > 1) ? x->frames - 2 : 0;
+    fm = m - f0;
+
+    // in double, since a phase just below 1 rounds to 1.0f in float; the
+    // clamp covers a small negative phase wrapping to exactly 1.0
+    pos = phase * MORPH_TABLE;
+    j = (int) pos;
+    if ( j > MORPH_TABLE - 1 ) j = MORPH_TABLE - 1;
+    fp = (float) (pos - j);
+
+    a = base + f0 * stride + j;
+    b = (x->frames > 1) ? a + stride : a;
+    va = a[0] + fp * (a[1] - a[0]);
+    vb = b[0] + fp * (b[1] - b[0]);
+    out[i] = va + fm * (vb - va);
+  }
+  x->phase = phase;
+  return w + 6;
+}
+
+static void pdmorph_dsp( t_pdmorph *x, t_signal **sp )
+{
+  x->sr = sp[0]->s_sr;
+  if ( !x->cache ) build_cache( x );
+  dsp_add( pdmorph_perform, 5, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, (t_int) sp[0]->s_n );
+}
+
+/****************************************************************/
+//  [ set <array> <array> ... ]  choose the source tables, in morph order
+static void pdmorph_set( t_pdmorph *x, t_symbol *s, int argc, t_atom *argv )
+{
+  int i;
+  if ( argc > MORPH_MAX_SOURCES ) {
+    post("morph~: at most %d source tables, ignoring the rest.", MORPH_MAX_SOURCES );
+    argc = MORPH_MAX_SOURCES;
+  }
+  x->sources = 0;
+  for ( i = 0; i < argc; i++ ) {
+    if ( argv[i].a_type != A_SYMBOL ) continue;
+    x->source[x->sources++] = atom_getsymbol( &argv[i] );
+  }
+  build_cache( x );
+}
+
+//  [ update ]  rebuild the cache after a source table changed
+static void pdmorph_update( t_pdmorph *x )
+{
+  build_cache( x );
+}
+
+//  [ phase <0-1> ]  restart the waveform
+static void pdmorph_phase( t_pdmorph *x, t_floatarg f )
+{
+  x->phase = f - floor( f );
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'morph~' object.
+///
+///  [ morph~ <array> <array> ... ]
+///  inlets: frequency in Hz (signal), morph position 0 .. sources-1 (signal)
+static void *pdmorph_new( t_symbol *s, int argc, t_atom *argv )
+{
+  t_pdmorph *x = (t_pdmorph *) pd_new(pdmorph_class);
+
+  x->x_f = 0;
+  x->sr = sys_getsr();
+  x->phase = 0;
+  x->sources = 0;
+  x->frames = 0;
+  x->cache = NULL;
+  // the tables usually load later in the same patch, so build on first DSP
+  // or [update( rather than now
+  for ( ; argc > 0 && x->sources < MORPH_MAX_SOURCES; argc--, argv++ )
+    if ( argv->a_type == A_SYMBOL ) x->source[x->sources++] = atom_getsymbol( argv );
+
+  inlet_new( &x->x_ob, &x->x_ob.ob_pd, &s_signal, &s_signal );
+  outlet_new( &x->x_ob, &s_signal );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Release an instance of a Pd 'morph~' object.
+static void pdmorph_free( t_pdmorph *x )
+{
+  if ( x->cache )
+    freebytes( x->cache, (size_t) MORPH_MIPS * x->frames * (MORPH_TABLE + 1) * sizeof(float) );
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'morph~' external.
+void morph_tilde_setup(void)
+{
+  int i;
+  for ( i = 0; i < MORPH_TABLE; i++ ) costab[i] = cos( 2.0 * M_PI * i / MORPH_TABLE );
+
+  pdmorph_class = class_new( gensym("morph~"),
+			     (t_newmethod) pdmorph_new,
+			     (t_method) pdmorph_free,
+			     sizeof(t_pdmorph),
+			     0,
+			     A_GIMME, 0);
+
+  CLASS_MAINSIGNALIN( pdmorph_class, t_pdmorph, x_f );
+  class_addmethod( pdmorph_class, (t_method) pdmorph_dsp, gensym("dsp"), A_CANT, 0 );
+  class_addmethod( pdmorph_class, (t_method) pdmorph_set, gensym("set"), A_GIMME, 0 );
+  class_addmethod( pdmorph_class, (t_method) pdmorph_update, gensym("update"), 0 );
+  class_addmethod( pdmorph_class, (t_method) pdmorph_phase, gensym("phase"), A_FLOAT, 0 );
+}
+
+/****************************************************************/
@@ -0,0 +1,465 @@
+/// pdnrpn.c : Pd external to decode and encode NRPN and 14-bit CC streams
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+//   MIDI 1.0 spec:     https://www.midi.org/specifications (NRPN, running status)
+
+// [nrpn] replaces nrpnin.pd and nrpnout.pd.  It reads the raw byte stream from
+// [midiin] instead of separate [ctlin 99], [ctlin 98], [ctlin 6] and
+// [ctlin 38] objects, so the parameter and data bytes of one channel can
+// never be paired with those of another.  Output bytes are meant for
+// [midiout].  Each encoded message starts with a full status byte and uses
+// running status only inside itself, since other objects may write to the
+// same port in between; [running_status 1] keeps it across messages for a
+// port this object has to itself.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define NRPN_CHANNELS      16
+#define NRPN_PARAMS        16384       ///< 14-bit parameter number space
+#define NRPN_MAX_MAPS      256         ///< mapped parameters per object
+#define NRPN_NONE          NRPN_PARAMS ///< no parameter selected
+
+// controller numbers
+#define CC_DATA_MSB        6
+#define CC_DATA_LSB        38
+#define CC_DATA_INC        96
+#define CC_DATA_DEC        97
+#define CC_NRPN_LSB        98
+#define CC_NRPN_MSB        99
+#define CC_RPN_LSB         100
+#define CC_RPN_MSB         101
+
+/****************************************************************/
+/// Receive state of one MIDI channel.
+typedef struct nrpn_channel
+{
+  int param_msb;           ///< last CC 99, or -1
+  int param_lsb;           ///< last CC 98, or -1
+  int rpn;                 ///< nonzero if CC 101/100 selected an RPN instead
+  int data_msb;            ///< last CC 6 for the selected parameter, or -1
+  int data_lsb;            ///< last CC 38, cleared by a new CC 6
+  int cc_msb[32];          ///< last MSB of controllers 0-31 for 14-bit CC pairing
+} t_nrpn_channel;
+
+/****************************************************************/
+/// A parameter number bound to a Pd receiver, with optional smoothing.
+typedef struct nrpn_map
+{
+  t_symbol *dest;          ///< receive name
+  float min, max;          ///< output range for raw 0..16383
+  float current;           ///< smoothed value last sent
+  float target;            ///< value most recently received
+  int active;              ///< nonzero while smoothing toward target
+} t_nrpn_map;
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'nrpn' object.
+typedef struct pdnrpn
+{
+  t_object x_ob;              ///< standard object header
+  t_outlet *x_nrpn_out;       ///< <param> <value> <channel> for NRPN
+  t_outlet *x_cc14_out;       ///< <cc> <value> <channel> for 14-bit CC
+  t_outlet *x_midi_out;       ///< raw bytes for [midiout]
+  t_clock *x_clock;           ///< control rate smoothing tick
+
+  t_nrpn_channel chan[NRPN_CHANNELS];
+  int channel_filter;         ///< 1-16 to accept only one channel, 0 for omni
+  int wait_lsb;               ///< if set, only complete MSB+LSB pairs are reported
+
+  // parser state for the incoming byte stream
+  int status;                 ///< running status byte, or 0
+  int data[2];
+  int ndata;
+
+  // encoder state, to use running status and skip repeated parameter selects
+  int out_status;
+  int out_running;            ///< keep running status across messages
+  int out_param[NRPN_CHANNELS];
+
+  // parameter number -> map slot, built by [map]
+  int16_t *lookup;            ///< NRPN_PARAMS entries, -1 if unmapped
+  int16_t cc_lookup[32];      ///< same for 14-bit controllers 0-31
+  t_nrpn_map map[NRPN_MAX_MAPS];
+  int nmaps;
+
+  float smooth_coef;          ///< one-pole coefficient per tick, 0 disables smoothing
+  double tick_ms;
+  int ticking;
+} t_pdnrpn;
+
+static t_class *pdnrpn_class;
+
+/****************************************************************/
+static void reset_channel( t_nrpn_channel *c )
+{
+  int i;
+  c->param_msb = c->param_lsb = -1;
+  c->rpn = 0;
+  c->data_msb = -1;
+  c->data_lsb = 0;
+  for ( i = 0; i < 32; i++ ) c->cc_msb[i] = -1;
+}
+
+/****************************************************************/
+// Send a value to a mapped receiver, either directly or through smoothing.
+static void map_value( t_pdnrpn *x, int slot, int raw )
+{
+  t_nrpn_map *m = &x->map[slot];
+  float value = m->min + (m->max - m->min) * (raw / 16383.0f);
+
+  if ( x->smooth_coef <= 0 ) {
+    m->current = m->target = value;
+    if ( m->dest->s_thing ) pd_float( m->dest->s_thing, value );
+    return;
+  }
+  m->target = value;
+  m->active = 1;
+  if ( !x->ticking ) {
+    x->ticking = 1;
+    clock_delay( x->x_clock, 0 );
+  }
+}
+
+/****************************************************************/
+// Control rate smoothing: move every active slot toward its target and stop
+// the clock once all of them have settled.
+static void pdnrpn_tick( t_pdnrpn *x )
+{
+  int i, busy = 0;
+  for ( i = 0; i < x->nmaps; i++ ) {
+    t_nrpn_map *m = &x->map[i];
+    if ( !m->active ) continue;
+    m->current += (m->target - m->current) * x->smooth_coef;
+    if ( fabsf( m->target - m->current ) <= 1e-4f * (fabsf( m->max - m->min ) + 1e-9f) ) {
+      m->current = m->target;
+      m->active = 0;
+    } else busy = 1;
+    if ( m->dest->s_thing ) pd_float( m->dest->s_thing, m->current );
+  }
+  x->ticking = busy;
+  if ( busy ) clock_delay( x->x_clock, x->tick_ms );
+}
+
+/****************************************************************/
+static void report( t_pdnrpn *x, t_outlet *out, int number, int value, int channel, int slot )
+{
+  t_atom a[3];
+  if ( slot >= 0 ) map_value( x, slot, value );
+  SETFLOAT( &a[0], number );
+  SETFLOAT( &a[1], value );
+  SETFLOAT( &a[2], channel + 1 );
+  outlet_list( out, &s_list, 3, a );
+}
+
+/****************************************************************/
+// Handle one complete control change.
+static void control_change( t_pdnrpn *x, int channel, int cc, int value )
+{
+  t_nrpn_channel *c = &x->chan[channel];
+  int param;
+
+  switch ( cc ) {
+  case CC_NRPN_MSB: c->param_msb = value; c->rpn = 0; c->data_msb = -1; return;
+  case CC_NRPN_LSB: c->param_lsb = value; c->rpn = 0; c->data_msb = -1; return;
+  case CC_RPN_MSB:
+  case CC_RPN_LSB:  c->rpn = 1; c->data_msb = -1; return;
+  }
+
+  param = (c->param_msb < 0 || c->param_lsb < 0 || c->rpn) ? -1 : (c->param_msb << 7) | c->param_lsb;
+
+  if ( param >= 0 && (cc == CC_DATA_MSB || cc == CC_DATA_LSB || cc == CC_DATA_INC || cc == CC_DATA_DEC) ) {
+    int slot = x->lookup[param], raw;
+    if ( cc == CC_DATA_MSB ) {
+      c->data_msb = value;
+      c->data_lsb = 0;
+      if ( x->wait_lsb ) return;
+      raw = value << 7;
+    } else if ( cc == CC_DATA_LSB ) {
+      if ( c->data_msb < 0 ) return;
+      c->data_lsb = value;
+      raw = (c->data_msb << 7) | value;
+    } else {
+      // increment and decrement step the 14-bit value by one
+      raw = (c->data_msb < 0) ? 0 : (c->data_msb << 7) | c->data_lsb;
+      raw += (cc == CC_DATA_INC) ? 1 : -1;
+      if ( raw < 0 ) raw = 0;
+      if ( raw > 16383 ) raw = 16383;
+      c->data_msb = raw >> 7;
+      c->data_lsb = raw & 0x7F;
+    }
+    report( x, x->x_nrpn_out, param, raw, channel, slot );
+    return;
+  }
+
+  // 14-bit controllers: 0-31 carry the MSB and 32-63 the matching LSB
+  if ( cc < 32 ) {
+    c->cc_msb[cc] = value;
+    if ( !x->wait_lsb ) report( x, x->x_cc14_out, cc, value << 7, channel, x->cc_lookup[cc] );
+  } else if ( cc < 64 && c->cc_msb[cc - 32] >= 0 ) {
+    report( x, x->x_cc14_out, cc - 32, (c->cc_msb[cc - 32] << 7) | value, channel, x->cc_lookup[cc - 32] );
+  }
+}
+
+/****************************************************************/
+/// A float is one raw MIDI byte from [midiin].  Running status is honoured
+/// and system realtime bytes may appear anywhere without disturbing it.
+static void pdnrpn_float( t_pdnrpn *x, t_floatarg f )
+{
+  int byte = (int) f & 0xFF;
+
+  if ( byte >= 0xF8 ) return;                  // realtime, ignore
+  if ( byte & 0x80 ) {
+    // system common messages cancel running status
+    x->status = (byte < 0xF0) ? byte : 0;
+    x->ndata = 0;
+    return;
+  }
+  if ( (x->status & 0xF0) != 0xB0 ) return;    // only control changes matter
+
+  x->data[x->ndata++] = byte;
+  if ( x->ndata < 2 ) return;
+  x->ndata = 0;                                // keep status for the next pair
+
+  if ( x->channel_filter && (x->status & 0x0F) != x->channel_filter - 1 ) return;
+  control_change( x, x->status & 0x0F, x->data[0], x->data[1] );
+}
+
+/****************************************************************/
+// Encoder helpers.  Output bytes go to the raw outlet one at a time.
+static void send_cc( t_pdnrpn *x, int channel, int cc, int value )
+{
+  int status = 0xB0 | channel;
+  if ( status != x->out_status ) {
+    outlet_float( x->x_midi_out, status );
+    x->out_status = status;
+  }
+  outlet_float( x->x_midi_out, cc & 0x7F );
+  outlet_float( x->x_midi_out, value & 0x7F );
+}
+
+static int channel_arg( int argcount, t_atom *argvec, int which )
+{
+  int channel = (argcount > which) ? atom_getint( &argvec[which] ) : 1;
+  if ( channel < 1 ) channel = 1;
+  if ( channel > NRPN_CHANNELS ) channel = NRPN_CHANNELS;
+  return channel - 1;
+}
+
+/****************************************************************/
+//  [ send <param> <value> [channel] ]  encode a 14-bit NRPN.  The parameter
+//  select is only sent when it differs from the last one on that channel.
+static void pdnrpn_send( t_pdnrpn *x, t_symbol *s, int argcount, t_atom *argvec )
+{
+  int param, value, channel;
+  if ( argcount < 2 ) {
+    post("nrpn error: send requires parameter and value.");
+    return;
+  }
+  param   = atom_getint( &argvec[0] ) & 0x3FFF;
+  value   = atom_getint( &argvec[1] );
+  channel = channel_arg( argcount, argvec, 2 );
+  if ( value < 0 ) value = 0;
+  if ( value > 16383 ) value = 16383;
+
+  if ( !x->out_running ) x->out_status = 0;
+  if ( x->out_param[channel] != param ) {
+    send_cc( x, channel, CC_NRPN_MSB, param >> 7 );
+    send_cc( x, channel, CC_NRPN_LSB, param );
+    x->out_param[channel] = param;
+  }
+  send_cc( x, channel, CC_DATA_MSB, value >> 7 );
+  send_cc( x, channel, CC_DATA_LSB, value );
+}
+
+/****************************************************************/
+//  [ cc14 <cc 0-31> <value> [channel] ]  encode a 14-bit controller pair
+static void pdnrpn_cc14( t_pdnrpn *x, t_symbol *s, int argcount, t_atom *argvec )
+{
+  int cc, value, channel;
+  if ( argcount < 2 ) {
+    post("nrpn error: cc14 requires controller and value.");
+    return;
+  }
+  cc      = atom_getint( &argvec[0] ) & 0x1F;
+  value   = atom_getint( &argvec[1] );
+  channel = channel_arg( argcount, argvec, 2 );
+  if ( value < 0 ) value = 0;
+  if ( value > 16383 ) value = 16383;
+
+  if ( !x->out_running ) x->out_status = 0;
+  send_cc( x, channel, cc, value >> 7 );
+  send_cc( x, channel, cc + 32, value );
+}
+
+/****************************************************************/
+// Bind a number to a receiver, reusing the slot if the name is already mapped.
+static int add_map( t_pdnrpn *x, int argcount, t_atom *argvec, const char *what )
+{
+  t_symbol *dest;
+  int i;
+
+  if ( argcount < 2 || argvec[1].a_type != A_SYMBOL ) {
+    post("nrpn error: %s requires a number and a receive name.", what );
+    return -1;
+  }
+  dest = atom_getsymbol( &argvec[1] );
+  for ( i = 0; i < x->nmaps; i++ ) if ( x->map[i].dest == dest ) break;
+  if ( i == x->nmaps ) {
+    if ( x->nmaps == NRPN_MAX_MAPS ) {
+      post("nrpn error: more than %d mapped parameters.", NRPN_MAX_MAPS );
+      return -1;
+    }
+    x->nmaps++;
+  }
+  x->map[i].dest    = dest;
+  x->map[i].min     = (argcount > 2) ? atom_getfloat( &argvec[2] ) : 0;
+  x->map[i].max     = (argcount > 3) ? atom_getfloat( &argvec[3] ) : 16383;
+  x->map[i].current = x->map[i].target = x->map[i].min;
+  x->map[i].active  = 0;
+  return i;
+}
+
+//  [ map <param> <receive-name> [min max] ]
+static void pdnrpn_map( t_pdnrpn *x, t_symbol *s, int argcount, t_atom *argvec )
+{
+  int slot = add_map( x, argcount, argvec, "map" );
+  if ( slot >= 0 ) x->lookup[atom_getint( &argvec[0] ) & 0x3FFF] = slot;
+}
+
+//  [ mapcc <cc 0-31> <receive-name> [min max] ]
+static void pdnrpn_mapcc( t_pdnrpn *x, t_symbol *s, int argcount, t_atom *argvec )
+{
+  int slot = add_map( x, argcount, argvec, "mapcc" );
+  if ( slot >= 0 ) x->cc_lookup[atom_getint( &argvec[0] ) & 0x1F] = slot;
+}
+
+//  [ clear ]  forget all mappings
+static void pdnrpn_clear( t_pdnrpn *x )
+{
+  memset( x->lookup, 0xff, NRPN_PARAMS * sizeof(int16_t) );
+  memset( x->cc_lookup, 0xff, sizeof(x->cc_lookup) );
+  x->nmaps = 0;
+}
+
+/****************************************************************/
+//  [ smooth <ms> ]  time constant of the control rate smoothing, 0 to disable
+static void pdnrpn_smooth( t_pdnrpn *x, t_floatarg ms )
+{
+  int i;
+
+  x->tick_ms = 1000.0 * sys_getblksize() / sys_getsr();
+  x->smooth_coef = (ms > 0) ? 1.0f - expf( -x->tick_ms / ms ) : 0;
+  if ( x->smooth_coef > 0 ) return;
+
+  // without smoothing the tick would never settle, so jump to the targets
+  for ( i = 0; i < x->nmaps; i++ ) {
+    t_nrpn_map *m = &x->map[i];
+    if ( !m->active ) continue;
+    m->current = m->target;
+    m->active = 0;
+    if ( m->dest->s_thing ) pd_float( m->dest->s_thing, m->current );
+  }
+  if ( x->ticking ) {
+    clock_unset( x->x_clock );
+    x->ticking = 0;
+  }
+}
+
+//  [ wait_lsb <0|1> ]  report only after the LSB of a pair arrives
+static void pdnrpn_wait_lsb( t_pdnrpn *x, t_floatarg on )
+{
+  x->wait_lsb = (on != 0);
+}
+
+//  [ running_status <0|1> ]  keep the output status byte across messages,
+//  only safe when nothing else writes to the same [midiout] port
+static void pdnrpn_running_status( t_pdnrpn *x, t_floatarg on )
+{
+  x->out_running = (on != 0);
+  x->out_status = 0;
+}
+
+//  [ reset ]  drop all receive and running status state
+static void pdnrpn_reset( t_pdnrpn *x )
+{
+  int i;
+  for ( i = 0; i < NRPN_CHANNELS; i++ ) {
+    reset_channel( &x->chan[i] );
+    x->out_param[i] = NRPN_NONE;
+  }
+  x->status = x->out_status = 0;
+  x->ndata = 0;
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'nrpn' object.
+///
+///  [ nrpn [channel] [smooth-ms] ]  channel 0 or omitted listens to all channels
+static void *pdnrpn_new( t_floatarg channel, t_floatarg smooth )
+{
+  t_pdnrpn *x = (t_pdnrpn *) pd_new(pdnrpn_class);
+
+  x->lookup = (int16_t *) getbytes( NRPN_PARAMS * sizeof(int16_t) );
+  pdnrpn_clear( x );
+  pdnrpn_reset( x );
+  x->channel_filter = (channel >= 1 && channel <= NRPN_CHANNELS) ? (int) channel : 0;
+  x->wait_lsb = 0;
+  x->out_running = 0;
+  x->ticking = 0;
+  pdnrpn_smooth( x, smooth );
+
+  x->x_nrpn_out = outlet_new( &x->x_ob, &s_list );
+  x->x_cc14_out = outlet_new( &x->x_ob, &s_list );
+  x->x_midi_out = outlet_new( &x->x_ob, &s_float );
+  x->x_clock = clock_new( x, (t_method) pdnrpn_tick );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Release an instance of a Pd 'nrpn' object.
+static void pdnrpn_free( t_pdnrpn *x )
+{
+  clock_free( x->x_clock );
+  freebytes( x->lookup, NRPN_PARAMS * sizeof(int16_t) );
+  outlet_free( x->x_nrpn_out );
+  outlet_free( x->x_cc14_out );
+  outlet_free( x->x_midi_out );
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'nrpn' external.
+void nrpn_setup(void)
+{
+  pdnrpn_class = class_new( gensym("nrpn"),
+			    (t_newmethod) pdnrpn_new,
+			    (t_method) pdnrpn_free,
+			    sizeof(t_pdnrpn),
+			    0,
+			    A_DEFFLOAT, A_DEFFLOAT, 0);
+
+  class_addfloat( pdnrpn_class, pdnrpn_float );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_send, gensym("send"), A_GIMME, 0 );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_cc14, gensym("cc14"), A_GIMME, 0 );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_map, gensym("map"), A_GIMME, 0 );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_mapcc, gensym("mapcc"), A_GIMME, 0 );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_clear, gensym("clear"), 0 );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_smooth, gensym("smooth"), A_FLOAT, 0 );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_wait_lsb, gensym("wait_lsb"), A_FLOAT, 0 );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_running_status, gensym("running_status"), A_FLOAT, 0 );
+  class_addmethod( pdnrpn_class, (t_method) pdnrpn_reset, gensym("reset"), 0 );
+}
+
+/****************************************************************/
@@ -0,0 +1,90 @@
+/// parambus.h : shared memory layout of the sy79 parameter bus
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// The parameter bus is a fixed-layout array of parameters in a POSIX shared
+// memory object (shm_open).  Pd owns the layout through the [parambus]
+// external; a GUI or controller process maps the same object and reads or
+// writes entries in place.
+//
+// Each entry is guarded by a sequence counter (a seqlock): a writer makes the
+// counter odd, stores the value and makes it even again, and a reader retries
+// whenever it saw an odd counter or the counter changed under it.  Writers
+// take the odd state with a compare-and-swap, so several processes may write.
+//
+// Changes are announced in two directions:
+//   - to_pd is a bitmap with one bit per entry.  Outside writers set the bit,
+//     and Pd collects and clears whole words once per block.
+//   - from_pd is a ring of entry indices written by Pd.  A reader keeps its
+//     own tail; if it falls more than PARAMBUS_RING_SIZE behind it rescans
+//     every entry's sequence counter instead.
+
+#ifndef PARAMBUS_H
+#define PARAMBUS_H
+
+#include <stdint.h>
+
+#define PARAMBUS_MAGIC          0x70627573   // 'pbus'
+#define PARAMBUS_VERSION        1
+#define PARAMBUS_MAX_PARAMS     1024
+#define PARAMBUS_NAME_LEN       32
+#define PARAMBUS_RING_SIZE      1024         // must be a power of two
+#define PARAMBUS_BITMAP_WORDS   (PARAMBUS_MAX_PARAMS / 32)
+
+/****************************************************************/
+/// One parameter.  The name is written once when the entry is defined and
+/// never changes afterwards, so it may be read without the seqlock.
+typedef struct parambus_entry
+{
+  uint32_t seq;                    ///< seqlock counter, odd while being written
+  float value;                     ///< current value
+  char name[PARAMBUS_NAME_LEN];    ///< Pd receive name of the parameter
+} parambus_entry;
+
+/****************************************************************/
+/// The whole shared memory object.
+typedef struct parambus_shm
+{
+  uint32_t magic;                            ///< PARAMBUS_MAGIC once initialized
+  uint32_t version;                          ///< PARAMBUS_VERSION
+  uint32_t count;                            ///< number of defined entries
+  uint32_t to_pd[PARAMBUS_BITMAP_WORDS];     ///< entries changed by other processes
+  uint32_t from_pd_head;                     ///< total number of indices pushed to from_pd
+  uint16_t from_pd[PARAMBUS_RING_SIZE];      ///< entries changed by Pd
+  parambus_entry entry[PARAMBUS_MAX_PARAMS];
+} parambus_shm;
+
+/****************************************************************/
+// Seqlock helpers shared by Pd and client processes.
+
+static inline float parambus_read( parambus_entry *e )
+{
+  uint32_t before, after;
+  float value;
+  do {
+    before = __atomic_load_n( &e->seq, __ATOMIC_ACQUIRE );
+    value  = *(volatile float *) &e->value;
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    after  = __atomic_load_n( &e->seq, __ATOMIC_RELAXED );
+  } while ( (before & 1) || before != after );
+  return value;
+}
+
+static inline void parambus_write( parambus_entry *e, float value )
+{
+  uint32_t seq;
+  do {
+    seq = __atomic_load_n( &e->seq, __ATOMIC_RELAXED ) & ~1u;
+  } while ( !__atomic_compare_exchange_n( &e->seq, &seq, seq + 1, 0,
+					  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ));
+  e->value = value;
+  __atomic_store_n( &e->seq, seq + 2, __ATOMIC_RELEASE );
+}
+
+/// Called by client processes after parambus_write to get Pd's attention.
+static inline void parambus_notify_pd( parambus_shm *bus, int index )
+{
+  __atomic_fetch_or( &bus->to_pd[index >> 5], 1u << (index & 31), __ATOMIC_RELEASE );
+}
+
+#endif // PARAMBUS_H
@@ -0,0 +1,312 @@
+/// pdparambus.c : Pd external exposing synth parameters on a shared memory bus
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+//   POSIX shm:         http://man7.org/linux/man-pages/man7/shm_overview.7.html
+
+// Build like the wiringPi external and link with -lrt.  The layout of the
+// shared memory object and the seqlock helpers for client processes are in
+// parambus.h.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#include "parambus.h"
+
+#define PARAMBUS_HASH_SIZE  (2 * PARAMBUS_MAX_PARAMS)   // power of two
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'parambus' object.
+typedef struct pdparambus
+{
+  t_object x_ob;           ///< standard object header
+  t_outlet *x_outlet;      ///< outlet for <name> <value> pairs changed outside Pd
+  t_clock *x_clock;        ///< polls the to_pd bitmap once per block
+
+  t_symbol *shm_name;      ///< name of the shared memory object
+  parambus_shm *bus;       ///< mapped bus, or NULL if not open
+  int polling;             ///< nonzero while the poll clock is running
+  double poll_ms;          ///< poll period, one DSP block
+
+  t_symbol *sym[PARAMBUS_MAX_PARAMS];       ///< receive name of each entry
+  int16_t hash[PARAMBUS_HASH_SIZE];         ///< open addressed symbol -> entry, -1 if empty
+} t_pdparambus;
+
+static t_class *pdparambus_class;
+
+/****************************************************************/
+// Symbols are unique in Pd, so the pointer itself is the hash key.
+static inline unsigned int symbol_hash( t_symbol *s )
+{
+  return ( (unsigned int)((uintptr_t) s >> 4) * 2654435761u ) & (PARAMBUS_HASH_SIZE - 1);
+}
+
+static int lookup_entry( t_pdparambus *x, t_symbol *s )
+{
+  unsigned int h = symbol_hash( s );
+  while ( x->hash[h] >= 0 ) {
+    if ( x->sym[x->hash[h]] == s ) return x->hash[h];
+    h = (h + 1) & (PARAMBUS_HASH_SIZE - 1);
+  }
+  return -1;
+}
+
+static void insert_entry( t_pdparambus *x, t_symbol *s, int index )
+{
+  unsigned int h = symbol_hash( s );
+  while ( x->hash[h] >= 0 ) h = (h + 1) & (PARAMBUS_HASH_SIZE - 1);
+  x->hash[h] = index;
+  x->sym[index] = s;
+}
+
+/****************************************************************/
+// Rebuild the symbol table from the names already on the bus, so that a
+// second Pd object or a restarted Pd sees the entries defined earlier.
+static void rebuild_index( t_pdparambus *x )
+{
+  uint32_t i, count = x->bus->count;
+  memset( x->hash, 0xff, sizeof(x->hash) );
+  memset( x->sym, 0, sizeof(x->sym) );
+  if ( count > PARAMBUS_MAX_PARAMS ) count = PARAMBUS_MAX_PARAMS;
+  for ( i = 0; i < count; i++ ) insert_entry( x, gensym( x->bus->entry[i].name ), i );
+}
+
+/****************************************************************/
+// Find a parameter by name, defining it on the bus if it is new.
+static int define_entry( t_pdparambus *x, t_symbol *s, float value )
+{
+  int index;
+  parambus_entry *e;
+
+  // another object may have defined entries since we last looked
+  if ( x->bus->count != 0 && x->sym[x->bus->count - 1] == NULL ) rebuild_index( x );
+  if ( (index = lookup_entry( x, s )) >= 0 ) return index;
+
+  if ( x->bus->count >= PARAMBUS_MAX_PARAMS ) {
+    post("parambus: bus full, cannot define %s.", s->s_name );
+    return -1;
+  }
+  if ( strlen( s->s_name ) >= PARAMBUS_NAME_LEN ) {
+    post("parambus: name %s longer than %d characters.", s->s_name, PARAMBUS_NAME_LEN - 1 );
+    return -1;
+  }
+
+  index = x->bus->count;
+  e = &x->bus->entry[index];
+  strncpy( e->name, s->s_name, PARAMBUS_NAME_LEN );
+  parambus_write( e, value );
+  insert_entry( x, s, index );
+  // publish the entry only after its name and value are in place
+  __atomic_store_n( &x->bus->count, index + 1, __ATOMIC_RELEASE );
+  return index;
+}
+
+/****************************************************************/
+// Write a value from Pd and announce it on the from_pd ring.
+static void write_entry( t_pdparambus *x, int index, float value )
+{
+  uint32_t head;
+  parambus_write( &x->bus->entry[index], value );
+  head = x->bus->from_pd_head;
+  x->bus->from_pd[head & (PARAMBUS_RING_SIZE - 1)] = index;
+  __atomic_store_n( &x->bus->from_pd_head, head + 1, __ATOMIC_RELEASE );
+}
+
+/****************************************************************/
+// Deliver one entry changed outside Pd: send it to the receiver of the same
+// name, which replaces the [s]/[r] fan-out, and report it on the outlet.
+static void deliver_entry( t_pdparambus *x, int index )
+{
+  t_symbol *s = x->sym[index];
+  float value = parambus_read( &x->bus->entry[index] );
+  t_atom a;
+
+  if ( !s ) return;
+  if ( s->s_thing ) pd_float( s->s_thing, value );
+  SETFLOAT( &a, value );
+  outlet_anything( x->x_outlet, s, 1, &a );
+}
+
+/****************************************************************/
+// Poll the to_pd bitmap.  Whole words are taken with one atomic exchange, so
+// an idle bus costs PARAMBUS_BITMAP_WORDS loads per block.
+static void pdparambus_tick( t_pdparambus *x )
+{
+  uint32_t w, count;
+
+  if ( !x->bus ) return;
+  count = __atomic_load_n( &x->bus->count, __ATOMIC_ACQUIRE );
+  if ( count != 0 && x->sym[count - 1] == NULL ) rebuild_index( x );
+
+  for ( w = 0; w < PARAMBUS_BITMAP_WORDS; w++ ) {
+    uint32_t bits;
+    if ( !__atomic_load_n( &x->bus->to_pd[w], __ATOMIC_RELAXED )) continue;
+    bits = __atomic_exchange_n( &x->bus->to_pd[w], 0, __ATOMIC_ACQUIRE );
+    while ( bits ) {
+      int bit = __builtin_ctz( bits );
+      bits &= bits - 1;
+      if ( (w << 5) + bit < count ) deliver_entry( x, (w << 5) + bit );
+    }
+  }
+  if ( x->polling ) clock_delay( x->x_clock, x->poll_ms );
+}
+
+/****************************************************************/
+static void pdparambus_close( t_pdparambus *x )
+{
+  if ( x->bus ) {
+    munmap( x->bus, sizeof(parambus_shm) );
+    x->bus = NULL;
+  }
+}
+
+/****************************************************************/
+// Map the shared memory object, creating and initializing it if needed.
+static void pdparambus_open( t_pdparambus *x, t_symbol *name )
+{
+  int fd;
+  void *mem;
+
+  pdparambus_close( x );
+  x->shm_name = name;
+
+  fd = shm_open( name->s_name, O_RDWR | O_CREAT, 0666 );
+  if ( fd < 0 ) {
+    post("parambus: shm_open %s returned error %d.", name->s_name, errno );
+    return;
+  }
+  if ( ftruncate( fd, sizeof(parambus_shm) ) < 0 ) {
+    post("parambus: ftruncate %s returned error %d.", name->s_name, errno );
+    close( fd );
+    return;
+  }
+  mem = mmap( NULL, sizeof(parambus_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( mem == MAP_FAILED ) {
+    post("parambus: mmap %s returned error %d.", name->s_name, errno );
+    return;
+  }
+
+  x->bus = (parambus_shm *) mem;
+  if ( x->bus->magic != PARAMBUS_MAGIC || x->bus->version != PARAMBUS_VERSION ) {
+    // a fresh object from ftruncate is all zeros
+    memset( x->bus, 0, sizeof(parambus_shm) );
+    x->bus->version = PARAMBUS_VERSION;
+    __atomic_store_n( &x->bus->magic, PARAMBUS_MAGIC, __ATOMIC_RELEASE );
+  }
+  rebuild_index( x );
+  post("parambus: opened %s with %d parameters.", name->s_name, x->bus->count );
+}
+
+/****************************************************************/
+// A bang reports every parameter on the outlet.
+static void pdparambus_bang( t_pdparambus *x )
+{
+  uint32_t i;
+  t_atom a;
+
+  if ( !x->bus ) return;
+  for ( i = 0; i < x->bus->count; i++ ) {
+    if ( !x->sym[i] ) continue;
+    SETFLOAT( &a, parambus_read( &x->bus->entry[i] ));
+    outlet_anything( x->x_outlet, x->sym[i], 1, &a );
+  }
+}
+
+/****************************************************************/
+//  [ define <name> <default> ]  reserve an entry at load time
+static void pdparambus_define( t_pdparambus *x, t_symbol *name, t_floatarg value )
+{
+  if ( x->bus ) define_entry( x, name, value );
+}
+
+/****************************************************************/
+//  [ poll <0|1> ]  start or stop collecting outside changes once per block
+static void pdparambus_poll( t_pdparambus *x, t_floatarg on )
+{
+  x->polling = (on != 0);
+  x->poll_ms = 1000.0 * sys_getblksize() / sys_getsr();
+  if ( x->polling ) clock_delay( x->x_clock, 0 );
+  else clock_unset( x->x_clock );
+}
+
+/****************************************************************/
+/// Any other message is a parameter update from Pd:  [ <name> <value> ]
+static void pdparambus_anything( t_pdparambus *x, t_symbol *selector, int argcount, t_atom *argvec )
+{
+  int index;
+
+  if ( !x->bus ) {
+    post("parambus: not open.");
+    return;
+  }
+  if ( argcount != 1 || argvec[0].a_type != A_FLOAT ) {
+    post("parambus: %s requires a single float value.", selector->s_name );
+    return;
+  }
+  index = define_entry( x, selector, atom_getfloat( &argvec[0] ));
+  if ( index >= 0 ) write_entry( x, index, atom_getfloat( &argvec[0] ));
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'parambus' object.
+///
+///  [ parambus <shm-name> ]  defaults to /sy79params; polling starts at once
+static void *pdparambus_new( t_symbol *name )
+{
+  t_pdparambus *x = (t_pdparambus *) pd_new(pdparambus_class);
+
+  x->bus = NULL;
+  x->polling = 0;
+  x->x_outlet = outlet_new( &x->x_ob, NULL );
+  x->x_clock = clock_new( x, (t_method) pdparambus_tick );
+
+  pdparambus_open( x, (name && *name->s_name) ? name : gensym("/sy79params") );
+  pdparambus_poll( x, 1 );
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Release an instance of a Pd 'parambus' object.  The shared memory object
+/// is left in place so that clients keep their mapping across Pd restarts.
+static void pdparambus_free( t_pdparambus *x )
+{
+  clock_free( x->x_clock );
+  pdparambus_close( x );
+  outlet_free( x->x_outlet );
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'parambus' external.
+void parambus_setup(void)
+{
+  pdparambus_class = class_new( gensym("parambus"),
+				(t_newmethod) pdparambus_new,
+				(t_method) pdparambus_free,
+				sizeof(t_pdparambus),
+				0,
+				A_DEFSYMBOL, 0);
+
+  class_addbang( pdparambus_class, pdparambus_bang );
+  class_addmethod( pdparambus_class, (t_method) pdparambus_define, gensym("define"), A_SYMBOL, A_DEFFLOAT, 0 );
+  class_addmethod( pdparambus_class, (t_method) pdparambus_poll, gensym("poll"), A_FLOAT, 0 );
+  class_addmethod( pdparambus_class, (t_method) pdparambus_open, gensym("open"), A_SYMBOL, 0 );
+  class_addanything( pdparambus_class, (t_method) pdparambus_anything );
+}
+
+/****************************************************************/
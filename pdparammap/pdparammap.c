@@ -0,0 +1,376 @@
+/// pdparammap.c : Pd external mapping controller values through precomputed response curves
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+
+// [parammap] replaces the arithmetic chains of parameter.pd, 2parameter.pd
+// and the paramnum*.pd abstractions ([/ 4], [clip min max], [/ max], ...)
+// with one object holding a table of parameters.  Each parameter has a
+// range and a response curve, which is sampled into a lookup table when the
+// parameter is defined, so converting a controller value is one table read
+// and an interpolation however expensive the curve.  Stepped curves, which
+// may have more steps than the table has points, are a rounding instead.
+//
+// Definitions come from messages or from a text file with one parameter per
+// line, so a whole patch's parameters load at once:
+//
+//   rate 1 2000 exp;
+//   wave 0 3 stepped 4;
+//   cutoff 20 18000 lookup cutoff-shape;
+//
+// A lookup curve takes its shape from a Pd array holding values from 0 to 1
+// which is stretched over the parameter's range.  Parameter names must
+// differ from the message names below.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define PARAMMAP_LUT_SIZE     256                       ///< curve segments per parameter
+#define PARAMMAP_MAX_PARAMS   512
+#define PARAMMAP_HASH_SIZE    (2 * PARAMMAP_MAX_PARAMS) // power of two
+
+enum { CURVE_LINEAR, CURVE_EXP, CURVE_STEPPED, CURVE_LOOKUP };
+
+/****************************************************************/
+/// One mapped parameter.
+typedef struct parammap_entry
+{
+  t_symbol *name;          ///< selector of incoming and outgoing values
+  t_symbol *array;         ///< shape array of a lookup curve
+  float min, max;
+  int curve;
+  int steps;               ///< number of values of a stepped curve
+  float last;              ///< value last sent
+  int sent;                ///< nonzero once a value was sent
+  float lut[PARAMMAP_LUT_SIZE + 1];
+} t_parammap_entry;
+
+/// Data structure to hold the state of a single Pd 'parammap' object.
+typedef struct pdparammap
+{
+  t_object x_ob;           ///< standard object header
+  t_outlet *x_outlet;      ///< <name> <value> for each converted parameter
+  t_canvas *x_canvas;      ///< for resolving file names
+
+  t_parammap_entry *entry; ///< parameters in definition order
+  int count;
+  int capacity;
+  int16_t hash[PARAMMAP_HASH_SIZE];   ///< open addressed symbol -> entry, -1 if empty
+
+  float input_max;         ///< controller value at the top of the range
+  float scale;             ///< table positions per controller step
+  int changes_only;        ///< if set, repeated values are not sent again
+} t_pdparammap;
+
+static t_class *pdparammap_class;
+
+/****************************************************************/
+// Symbols are unique in Pd, so the pointer itself is the hash key.
+static inline unsigned int symbol_hash( t_symbol *s )
+{
+  return ( (unsigned int)((uintptr_t) s >> 4) * 2654435761u ) & (PARAMMAP_HASH_SIZE - 1);
+}
+
+static int lookup_entry( t_pdparammap *x, t_symbol *s )
+{
+  unsigned int h = symbol_hash( s );
+  while ( x->hash[h] >= 0 ) {
+    if ( x->entry[x->hash[h]].name == s ) return x->hash[h];
+    h = (h + 1) & (PARAMMAP_HASH_SIZE - 1);
+  }
+  return -1;
+}
+
+static void insert_entry( t_pdparammap *x, t_symbol *s, int index )
+{
+  unsigned int h = symbol_hash( s );
+  while ( x->hash[h] >= 0 ) h = (h + 1) & (PARAMMAP_HASH_SIZE - 1);
+  x->hash[h] = index;
+}
+
+/****************************************************************/
+// Sample the response curve into the lookup table.
+static void build_lut( t_pdparammap *x, t_parammap_entry *e )
+{
+  float range = e->max - e->min;
+  t_word *vec = NULL;
+  int size = 0, i;
+
+  if ( e->curve == CURVE_LOOKUP ) {
+    t_garray *a;
+    if ( !(a = (t_garray *) pd_findbyclass( e->array, garray_class ))) {
+      pd_error( x, "parammap: %s: no such array", e->array->s_name );
+    } else if ( !garray_getfloatwords( a, &size, &vec ) || size < 1 ) {
+      pd_error( x, "parammap: %s: bad template", e->array->s_name );
+      vec = NULL;
+    }
+  }
+
+  for ( i = 0; i <= PARAMMAP_LUT_SIZE; i++ ) {
+    double pos = (double) i / PARAMMAP_LUT_SIZE, shape = pos;
+
+    switch ( e->curve ) {
+    case CURVE_EXP:
+      if ( e->min * e->max > 0 ) {
+	e->lut[i] = e->min * pow( e->max / e->min, pos );
+	continue;
+      }
+      // a range through zero gets a 60 dB curve instead
+      shape = (pow( 1000, pos ) - 1) / 999;
+      break;
+    case CURVE_STEPPED:
+      shape = (e->steps > 1) ? floor( pos * (e->steps - 1) + 0.5 ) / (e->steps - 1) : 0;
+      break;
+    case CURVE_LOOKUP:
+      if ( vec ) {
+	double where = pos * (size - 1);
+	int j = (int) where;
+	if ( j >= size - 1 ) shape = vec[size - 1].w_float;
+	else shape = vec[j].w_float + (where - j) * (vec[j + 1].w_float - vec[j].w_float);
+      }
+      break;
+    }
+    e->lut[i] = e->min + range * shape;
+  }
+}
+
+/****************************************************************/
+// Convert one controller value.  Stepped curves are computed directly, since
+// a range like 1 to 5000 has far more steps than the table has points; the
+// others interpolate the table.
+static inline float map_value( t_pdparammap *x, t_parammap_entry *e, float raw )
+{
+  float pos = raw * x->scale, frac;
+  int i;
+
+  if ( pos <= 0 ) return e->lut[0];
+  if ( pos >= PARAMMAP_LUT_SIZE ) return e->lut[PARAMMAP_LUT_SIZE];
+  if ( e->curve == CURVE_STEPPED )
+    return e->min + (e->max - e->min) * floorf( pos * (e->steps - 1) / PARAMMAP_LUT_SIZE + 0.5f ) / (e->steps - 1);
+  i = (int) pos;
+  frac = pos - i;
+  return e->lut[i] + frac * (e->lut[i + 1] - e->lut[i]);
+}
+
+static void deliver( t_pdparammap *x, int index, float raw )
+{
+  t_parammap_entry *e = &x->entry[index];
+  float value = map_value( x, e, raw );
+  t_atom a;
+
+  if ( x->changes_only && e->sent && value == e->last ) return;
+  e->last = value;
+  e->sent = 1;
+  SETFLOAT( &a, value );
+  outlet_anything( x->x_outlet, e->name, 1, &a );
+}
+
+/****************************************************************/
+// Define or redefine a parameter from <name> <min> <max> [curve [arg]].
+static void define_param( t_pdparammap *x, int argcount, t_atom *argvec )
+{
+  t_parammap_entry *e;
+  t_symbol *name;
+  int index;
+
+  if ( argcount < 3 || argvec[0].a_type != A_SYMBOL ) {
+    post("parammap error: param requires name, min and max.");
+    return;
+  }
+  name = atom_getsymbol( &argvec[0] );
+
+  if ( (index = lookup_entry( x, name )) < 0 ) {
+    if ( x->count == PARAMMAP_MAX_PARAMS ) {
+      post("parammap: more than %d parameters, ignoring %s.", PARAMMAP_MAX_PARAMS, name->s_name );
+      return;
+    }
+    if ( x->count == x->capacity ) {
+      int grown = 2 * x->capacity;
+      x->entry = (t_parammap_entry *) resizebytes( x->entry, x->capacity * sizeof(t_parammap_entry),
+						    grown * sizeof(t_parammap_entry) );
+      x->capacity = grown;
+    }
+    index = x->count++;
+    insert_entry( x, name, index );
+  }
+
+  e = &x->entry[index];
+  e->name  = name;
+  e->array = NULL;
+  e->min   = atom_getfloat( &argvec[1] );
+  e->max   = atom_getfloat( &argvec[2] );
+  e->curve = CURVE_LINEAR;
+  e->steps = 2;
+  e->sent  = 0;
+
+  if ( argcount > 3 ) {
+    const char *curve = atom_getsymbol( &argvec[3] )->s_name;
+    if ( !strcmp( curve, "exp" )) {
+      e->curve = CURVE_EXP;
+    } else if ( !strcmp( curve, "stepped" )) {
+      e->curve = CURVE_STEPPED;
+      // by default one step per integer in the range, like [i] after [clip]
+      e->steps = (argcount > 4) ? atom_getint( &argvec[4] ) : (int) fabsf( e->max - e->min ) + 1;
+      if ( e->steps < 2 ) e->steps = 2;
+    } else if ( !strcmp( curve, "lookup" ) && argcount > 4 && argvec[4].a_type == A_SYMBOL ) {
+      e->curve = CURVE_LOOKUP;
+      e->array = atom_getsymbol( &argvec[4] );
+    } else if ( strcmp( curve, "linear" )) {
+      post("parammap: unrecognized curve %s for %s, using linear.", curve, name->s_name );
+    }
+  }
+  build_lut( x, e );
+}
+
+//  [ param <name> <min> <max> [linear|exp|stepped [steps]|lookup <array>] ]
+static void pdparammap_param( t_pdparammap *x, t_symbol *s, int argcount, t_atom *argvec )
+{
+  define_param( x, argcount, argvec );
+}
+
+//  [ read <file> ]  define parameters from a file, one definition per line
+static void pdparammap_read( t_pdparammap *x, t_symbol *file )
+{
+  t_binbuf *b = binbuf_new();
+  t_atom *vec;
+  int n, i, start = 0;
+
+  if ( binbuf_read_via_canvas( b, file->s_name, x->x_canvas, 0 )) {
+    pd_error( x, "parammap: %s: read failed", file->s_name );
+    binbuf_free( b );
+    return;
+  }
+  n = binbuf_getnatom( b );
+  vec = binbuf_getvec( b );
+  for ( i = 0; i <= n; i++ ) {
+    if ( i < n && vec[i].a_type != A_SEMI ) continue;
+    if ( i > start ) define_param( x, i - start, vec + start );
+    start = i + 1;
+  }
+  binbuf_free( b );
+}
+
+//  [ clear ]  forget all parameters
+static void pdparammap_clear( t_pdparammap *x )
+{
+  memset( x->hash, 0xff, sizeof(x->hash) );
+  x->count = 0;
+}
+
+//  [ update ]  resample the lookup curves after their arrays changed
+static void pdparammap_update( t_pdparammap *x )
+{
+  int i;
+  for ( i = 0; i < x->count; i++ )
+    if ( x->entry[i].curve == CURVE_LOOKUP ) build_lut( x, &x->entry[i] );
+}
+
+//  [ input <max> ]  controller value at the top of every range, 127 by default
+static void pdparammap_input( t_pdparammap *x, t_floatarg max )
+{
+  x->input_max = (max > 0) ? max : 127;
+  x->scale = PARAMMAP_LUT_SIZE / x->input_max;
+}
+
+//  [ changes <0|1> ]  send only values that differ from the last one sent
+static void pdparammap_changes( t_pdparammap *x, t_floatarg on )
+{
+  x->changes_only = (on != 0);
+}
+
+/****************************************************************/
+/// A list of floats updates the parameters in definition order, so a whole
+/// controller dump or preset is converted by one message.
+static void pdparammap_list( t_pdparammap *x, t_symbol *s, int argcount, t_atom *argvec )
+{
+  int i;
+  if ( argcount > x->count ) argcount = x->count;
+  for ( i = 0; i < argcount; i++ )
+    if ( argvec[i].a_type == A_FLOAT ) deliver( x, i, argvec[i].a_w.w_float );
+}
+
+//  [ batch <name> <value> <name> <value> ... ]  update parameters by name
+static void pdparammap_batch( t_pdparammap *x, t_symbol *s, int argcount, t_atom *argvec )
+{
+  int i, index;
+  for ( i = 0; i + 1 < argcount; i += 2 ) {
+    if ( argvec[i].a_type != A_SYMBOL ) continue;
+    if ( (index = lookup_entry( x, argvec[i].a_w.w_symbol )) >= 0 )
+      deliver( x, index, atom_getfloat( &argvec[i + 1] ));
+    else post("parammap: no parameter %s.", argvec[i].a_w.w_symbol->s_name );
+  }
+}
+
+//  [ <name> <value> ]  update one parameter
+static void pdparammap_anything( t_pdparammap *x, t_symbol *selector, int argcount, t_atom *argvec )
+{
+  int index = lookup_entry( x, selector );
+  if ( index < 0 ) {
+    post("parammap: no parameter %s.", selector->s_name );
+    return;
+  }
+  if ( argcount > 0 ) deliver( x, index, atom_getfloat( &argvec[0] ));
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'parammap' object.
+///
+///  [ parammap [input-max] [file] ]  input-max defaults to 127
+static void *pdparammap_new( t_symbol *s, int argcount, t_atom *argvec )
+{
+  t_pdparammap *x = (t_pdparammap *) pd_new(pdparammap_class);
+
+  x->x_canvas = canvas_getcurrent();
+  x->capacity = 16;
+  x->entry = (t_parammap_entry *) getbytes( x->capacity * sizeof(t_parammap_entry) );
+  x->changes_only = 1;
+  pdparammap_clear( x );
+  pdparammap_input( x, (argcount > 0) ? atom_getfloat( &argvec[0] ) : 0 );
+
+  x->x_outlet = outlet_new( &x->x_ob, &s_anything );
+  if ( argcount > 1 && argvec[1].a_type == A_SYMBOL ) pdparammap_read( x, atom_getsymbol( &argvec[1] ));
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Release an instance of a Pd 'parammap' object.
+static void pdparammap_free( t_pdparammap *x )
+{
+  freebytes( x->entry, x->capacity * sizeof(t_parammap_entry) );
+  outlet_free( x->x_outlet );
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'parammap' external.
+void parammap_setup(void)
+{
+  pdparammap_class = class_new( gensym("parammap"),
+				(t_newmethod) pdparammap_new,
+				(t_method) pdparammap_free,
+				sizeof(t_pdparammap),
+				0,
+				A_GIMME, 0);
+
+  class_addlist( pdparammap_class, pdparammap_list );
+  class_addanything( pdparammap_class, (t_method) pdparammap_anything );
+  class_addmethod( pdparammap_class, (t_method) pdparammap_param, gensym("param"), A_GIMME, 0 );
+  class_addmethod( pdparammap_class, (t_method) pdparammap_batch, gensym("batch"), A_GIMME, 0 );
+  class_addmethod( pdparammap_class, (t_method) pdparammap_read, gensym("read"), A_SYMBOL, 0 );
+  class_addmethod( pdparammap_class, (t_method) pdparammap_clear, gensym("clear"), 0 );
+  class_addmethod( pdparammap_class, (t_method) pdparammap_update, gensym("update"), 0 );
+  class_addmethod( pdparammap_class, (t_method) pdparammap_input, gensym("input"), A_FLOAT, 0 );
+  class_addmethod( pdparammap_class, (t_method) pdparammap_changes, gensym("changes"), A_FLOAT, 0 );
+}
+
+/****************************************************************/
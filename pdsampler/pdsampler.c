@@ -0,0 +1,516 @@
+/// pdsampler.c : Pd external to play large WAV files from memory-mapped storage
+/// Provided under the terms of the GNU General Public License v3, see LICENSE.
+
+/****************************************************************/
+// Links to related reference documentation:
+
+//   Pd externals:      http://pdstatic.iem.at/externals-HOWTO/node9.html
+//   WAV format:        http://soundfile.sapp.org/doc/WaveFormat/
+
+// [sampler~] replaces the soundfiler/tabread4~ pair in sampleplayer.pd.  A
+// file is memory-mapped instead of read into a Pd array, so loading does not
+// block the scheduler on the whole file and only the pages being played are
+// resident.  The first SAMPLER_HEAD_FRAMES of every slot are converted up
+// front so a trigger starts at once; the rest is converted by a read-ahead
+// thread into a single-producer, single-consumer ring which the DSP loop reads
+// without locking.  The DSP loop itself never touches the mapping, so it never
+// takes a page fault.
+//
+// Slots are handed over without locks either.  A slot replaced by load or
+// unload is pushed onto a retire stack, and the read-ahead thread unmaps it
+// once it has stopped reading from it, so Pd never waits for the thread's
+// disk reads.
+
+/****************************************************************/
+// import standard libc API
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Import the API for Pd externals.
+#include "m_pd.h"
+
+#define SAMPLER_SLOTS        16
+#define SAMPLER_HEAD_FRAMES  32768       ///< preloaded frames per slot
+#define SAMPLER_RING_FRAMES  65536       ///< must be a power of two
+#define SAMPLER_RING_MASK    (SAMPLER_RING_FRAMES - 1)
+#define SAMPLER_CHUNK        4096        ///< frames converted per ring update
+#define SAMPLER_GUARD        8           ///< frames kept behind the play position
+
+enum { WAV_INT16, WAV_INT24, WAV_INT32, WAV_FLOAT32 };
+
+/****************************************************************/
+/// One mapped sample file.
+typedef struct sampler_slot
+{
+  t_symbol *name;              ///< file name as given, or NULL if empty
+  uint8_t *map;                ///< whole file mapping
+  size_t map_size;
+  const uint8_t *data;         ///< first byte of the first frame
+  int format;                  ///< WAV_INT16 ...
+  int channels;
+  int frame_bytes;
+  long frames;
+  float sr;
+  float *head;                 ///< mono floats for the first head_frames frames
+  long head_frames;
+  struct sampler_slot *next_retired;
+} t_sampler_slot;
+
+/****************************************************************/
+/// Data structure to hold the state of a single Pd 'sampler~' object.
+typedef struct pdsampler
+{
+  t_object x_ob;               ///< standard object header
+  t_float x_f;                 ///< main signal inlet scalar: playback speed
+  t_outlet *x_done;            ///< bang when a sample reaches its end
+  t_clock *x_clock;            ///< defers the done bang out of the DSP loop
+  t_canvas *x_canvas;          ///< to resolve relative file names
+
+  t_sampler_slot *slot[SAMPLER_SLOTS];   ///< loaded slots, changed by Pd only
+  t_sampler_slot *retired;                ///< replaced slots for the thread to release
+
+  // voice, owned by the DSP loop
+  int playing;
+  int play_slot;
+  double pos;                  ///< fractional frame position
+  float gain;
+  unsigned int underruns;
+
+  // DSP -> thread
+  t_sampler_slot *volatile req_slot;   ///< slot to read ahead, NULL for none
+  volatile unsigned int req_gen;   ///< bumped on every trigger
+  volatile long read_pos;          ///< lowest frame the DSP still needs
+
+  // thread -> DSP
+  volatile unsigned int ring_gen;  ///< generation the ring is filled for
+  volatile long ring_end;          ///< frames before this are in the ring
+  float ring[SAMPLER_RING_FRAMES];
+
+  pthread_t thread;
+  volatile int running;
+} t_pdsampler;
+
+static t_class *pdsampler_class;
+
+/****************************************************************/
+// Convert n frames starting at frame to mono floats.  out is indexed through
+// mask so the same routine fills the head (mask -1) and the ring.
+static void convert_frames( t_sampler_slot *s, long frame, long n, float *out, long mask )
+{
+  const uint8_t *p = s->data + frame * s->frame_bytes;
+  float scale = 1.0f / s->channels;
+  long i;
+  int c;
+
+  for ( i = 0; i < n; i++ ) {
+    float sum = 0;
+    for ( c = 0; c < s->channels; c++ ) {
+      switch ( s->format ) {
+      case WAV_INT16:
+	sum += (int16_t) (p[0] | (p[1] << 8)) * (1.0f / 32768.0f);
+	p += 2;
+	break;
+      case WAV_INT24:
+	sum += (int32_t) ((p[0] << 8) | (p[1] << 16) | ((uint32_t) p[2] << 24)) * (1.0f / 2147483648.0f);
+	p += 3;
+	break;
+      case WAV_INT32:
+	sum += (int32_t) (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24)) * (1.0f / 2147483648.0f);
+	p += 4;
+	break;
+      default: {
+	float f;
+	memcpy( &f, p, 4 );
+	sum += f;
+	p += 4;
+      }
+      }
+    }
+    out[(frame + i) & mask] = sum * scale;
+  }
+}
+
+/****************************************************************/
+static uint32_t le32( const uint8_t *p ) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24); }
+static uint16_t le16( const uint8_t *p ) { return p[0] | (p[1] << 8); }
+
+/****************************************************************/
+// Walk the RIFF chunks for the format and data chunks.  Returns 0 on success.
+static int parse_wav( t_sampler_slot *s )
+{
+  const uint8_t *p = s->map, *end = s->map + s->map_size, *fmt = NULL;
+  int tag, bits;
+
+  if ( s->map_size < 12 || memcmp( p, "RIFF", 4 ) || memcmp( p + 8, "WAVE", 4 )) return -1;
+  p += 12;
+  s->data = NULL;
+  while ( p + 8 <= end ) {
+    uint32_t size = le32( p + 4 );
+    // a chunk running past the end of the file means a truncated or corrupt
+    // file, and every read below stays inside a chunk's declared size
+    if ( size > (size_t) (end - p - 8) ) return -1;
+    if ( !memcmp( p, "fmt ", 4 )) {
+      if ( size < 16 ) return -1;
+      fmt = p + 8;
+    }
+    if ( !memcmp( p, "data", 4 )) {
+      s->data = p + 8;
+      s->frames = size;
+      break;
+    }
+    p += 8 + size + (size & 1);
+  }
+  if ( !fmt || !s->data ) return -1;
+
+  tag        = le16( fmt );
+  s->channels = le16( fmt + 2 );
+  s->sr      = le32( fmt + 4 );
+  bits       = le16( fmt + 14 );
+  if ( tag == 0xFFFE && le32( fmt - 4 ) >= 26 ) tag = le16( fmt + 24 );   // extensible
+
+  if ( tag == 1 && bits == 16 )      s->format = WAV_INT16;
+  else if ( tag == 1 && bits == 24 ) s->format = WAV_INT24;
+  else if ( tag == 1 && bits == 32 ) s->format = WAV_INT32;
+  else if ( tag == 3 && bits == 32 ) s->format = WAV_FLOAT32;
+  else return -1;
+  if ( s->channels < 1 ) return -1;
+
+  s->frame_bytes = s->channels * bits / 8;
+  s->frames /= s->frame_bytes;
+  return 0;
+}
+
+/****************************************************************/
+// Slots are allocated with malloc since the read-ahead thread frees them.
+static void release_slot( t_sampler_slot *s )
+{
+  free( s->head );
+  munmap( s->map, s->map_size );
+  free( s );
+}
+
+// Take a slot out of use and hand it to the thread.  A pending read-ahead
+// request for it is withdrawn first, so once the thread has seen the slot on
+// the retire stack it can never pick the slot up again.
+static void retire_slot( t_pdsampler *x, int index )
+{
+  t_sampler_slot *s = x->slot[index];
+  if ( !s ) return;
+
+  // the voice never outlives its slot
+  if ( x->playing && x->play_slot == index ) x->playing = 0;
+  x->slot[index] = NULL;
+  if ( x->req_slot == s ) {
+    __atomic_store_n( &x->req_slot, NULL, __ATOMIC_RELAXED );
+    __atomic_store_n( &x->req_gen, x->req_gen + 1, __ATOMIC_RELEASE );
+  }
+  s->next_retired = __atomic_load_n( &x->retired, __ATOMIC_RELAXED );
+  while ( !__atomic_compare_exchange_n( &x->retired, &s->next_retired, s, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED ));
+}
+
+/****************************************************************/
+// Read-ahead thread.  Follows the generation requested by the DSP loop and
+// keeps the ring filled up to SAMPLER_RING_FRAMES ahead of read_pos.
+static void *sampler_readahead( void *arg )
+{
+  t_pdsampler *x = (t_pdsampler *) arg;
+  t_sampler_slot *s = NULL, *retired;
+  unsigned int gen = 0;
+  long cursor = 0;
+  struct timespec nap = { 0, 2000000 };
+
+  while ( x->running ) {
+    unsigned int want = __atomic_load_n( &x->req_gen, __ATOMIC_ACQUIRE );
+    long n = 0;
+
+    if ( want != gen ) {
+      gen = want;
+      s = __atomic_load_n( &x->req_slot, __ATOMIC_ACQUIRE );
+      cursor = s ? s->head_frames : 0;
+      __atomic_store_n( &x->ring_end, cursor, __ATOMIC_RELAXED );
+      __atomic_store_n( &x->ring_gen, gen, __ATOMIC_RELEASE );
+    }
+
+    // release replaced slots, including the one being read if it is among them
+    retired = __atomic_exchange_n( &x->retired, NULL, __ATOMIC_ACQUIRE );
+    while ( retired ) {
+      t_sampler_slot *next = retired->next_retired;
+      if ( retired == s ) s = NULL;
+      release_slot( retired );
+      retired = next;
+    }
+
+    if ( s ) {
+      long limit = __atomic_load_n( &x->read_pos, __ATOMIC_ACQUIRE ) + SAMPLER_RING_FRAMES - SAMPLER_GUARD;
+      n = SAMPLER_CHUNK;
+      if ( n > limit - cursor ) n = limit - cursor;
+      if ( n > s->frames - cursor ) n = s->frames - cursor;
+      if ( n > 0 ) {
+	convert_frames( s, cursor, n, x->ring, SAMPLER_RING_MASK );
+	// let the kernel start on the pages of the next chunk
+	madvise( (void *) ((uintptr_t) (s->data + (cursor + n) * s->frame_bytes) & ~(uintptr_t) 4095),
+		 SAMPLER_CHUNK * s->frame_bytes + 4096, MADV_WILLNEED );
+      }
+    }
+
+    if ( n > 0 ) {
+      cursor += n;
+      __atomic_store_n( &x->ring_end, cursor, __ATOMIC_RELEASE );
+    } else {
+      nanosleep( &nap, NULL );
+    }
+  }
+  return NULL;
+}
+
+/****************************************************************/
+//  [ load <slot> <file> ]  map a WAV file into a slot, replacing its contents
+static void pdsampler_load( t_pdsampler *x, t_floatarg f, t_symbol *file )
+{
+  int index = (int) f, fd;
+  char path[MAXPDSTRING];
+  struct stat st;
+  t_sampler_slot s, *slot;
+
+  if ( index < 0 || index >= SAMPLER_SLOTS ) {
+    post("sampler~: slot %d out of range.", index );
+    return;
+  }
+  canvas_makefilename( x->x_canvas, file->s_name, path, MAXPDSTRING );
+
+  memset( &s, 0, sizeof(s) );
+  if ( (fd = open( path, O_RDONLY )) < 0 ) {
+    post("sampler~: unable to open %s, error %d.", path, errno );
+    return;
+  }
+  if ( fstat( fd, &st ) < 0 || st.st_size == 0 ) {
+    post("sampler~: unable to stat %s.", path );
+    close( fd );
+    return;
+  }
+  s.map_size = st.st_size;
+  s.map = mmap( NULL, s.map_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( s.map == MAP_FAILED ) {
+    post("sampler~: unable to map %s, error %d.", path, errno );
+    return;
+  }
+  if ( parse_wav( &s )) {
+    post("sampler~: %s is not a 16, 24 or 32 bit PCM or float WAV file.", path );
+    munmap( s.map, s.map_size );
+    return;
+  }
+  madvise( s.map, s.map_size, MADV_SEQUENTIAL );
+
+  s.name = file;
+  s.head_frames = (s.frames < SAMPLER_HEAD_FRAMES) ? s.frames : SAMPLER_HEAD_FRAMES;
+  s.head = (float *) malloc( s.head_frames * sizeof(float) );
+  slot = (t_sampler_slot *) malloc( sizeof(t_sampler_slot) );
+  if ( !s.head || !slot ) {
+    post("sampler~: out of memory loading %s.", path );
+    free( s.head );
+    free( slot );
+    munmap( s.map, s.map_size );
+    return;
+  }
+  convert_frames( &s, 0, s.head_frames, s.head, -1 );
+  *slot = s;
+
+  retire_slot( x, index );
+  x->slot[index] = slot;
+}
+
+/****************************************************************/
+//  [ unload <slot> ]
+static void pdsampler_unload( t_pdsampler *x, t_floatarg f )
+{
+  int index = (int) f;
+  if ( index < 0 || index >= SAMPLER_SLOTS ) return;
+  retire_slot( x, index );
+}
+
+/****************************************************************/
+//  [ play <slot> [gain] ]  start a slot from the beginning
+static void pdsampler_play( t_pdsampler *x, t_floatarg f, t_floatarg gain )
+{
+  int index = (int) f;
+  if ( index < 0 || index >= SAMPLER_SLOTS || !x->slot[index] ) {
+    post("sampler~: slot %d is empty.", index );
+    return;
+  }
+  x->play_slot = index;
+  x->pos = 0;
+  x->gain = (gain > 0) ? gain : 1;
+  x->playing = 1;
+
+  __atomic_store_n( &x->read_pos, 0, __ATOMIC_RELAXED );
+  __atomic_store_n( &x->req_slot, x->slot[index], __ATOMIC_RELAXED );
+  __atomic_store_n( &x->req_gen, x->req_gen + 1, __ATOMIC_RELEASE );
+}
+
+static void pdsampler_stop( t_pdsampler *x )
+{
+  x->playing = 0;
+}
+
+/****************************************************************/
+// A bang reports the number of ring underruns since the last bang.
+static void pdsampler_bang( t_pdsampler *x )
+{
+  post("sampler~: %u underruns.", x->underruns );
+  x->underruns = 0;
+}
+
+static void pdsampler_tick( t_pdsampler *x )
+{
+  outlet_bang( x->x_done );
+}
+
+/****************************************************************/
+// Fetch one frame from the head or the ring.  Frames the thread has not
+// reached yet are counted as underruns and play as silence.
+static inline float fetch( t_pdsampler *x, t_sampler_slot *s, long frame, int ring_ok, long ring_end )
+{
+  if ( frame < 0 ) frame = 0;
+  if ( frame < s->head_frames ) return s->head[frame];
+  if ( ring_ok && frame < ring_end ) return x->ring[frame & SAMPLER_RING_MASK];
+  x->underruns++;
+  return 0;
+}
+
+/****************************************************************/
+// DSP loop.  The speed input is a ratio, 1 plays at the file's own pitch;
+// the file rate is converted to Pd's rate.  Playback uses 4-point Hermite
+// interpolation.
+static t_int *pdsampler_perform( t_int *w )
+{
+  t_pdsampler *x = (t_pdsampler *) w[1];
+  t_sample *speed = (t_sample *) w[2];
+  t_sample *out = (t_sample *) w[3];
+  int n = (int) w[4], i;
+  t_sampler_slot *s = x->slot[x->play_slot];
+  double pos = x->pos, ratio;
+  long ring_end, last;
+  int ring_ok;
+
+  if ( !x->playing || !s ) {
+    memset( out, 0, n * sizeof(t_sample) );
+    return w + 5;
+  }
+
+  ring_ok  = __atomic_load_n( &x->ring_gen, __ATOMIC_ACQUIRE ) == x->req_gen;
+  ring_end = __atomic_load_n( &x->ring_end, __ATOMIC_ACQUIRE );
+  ratio = s->sr / sys_getsr();
+  last = s->frames - 1;
+
+  for ( i = 0; i < n; i++ ) {
+    long f = (long) pos;
+    float t = (float) (pos - f), a, b, c, d;
+
+    if ( f >= last ) {
+      memset( out + i, 0, (n - i) * sizeof(t_sample) );
+      x->playing = 0;
+      clock_delay( x->x_clock, 0 );
+      break;
+    }
+    a = fetch( x, s, f - 1, ring_ok, ring_end );
+    b = fetch( x, s, f, ring_ok, ring_end );
+    c = fetch( x, s, f + 1, ring_ok, ring_end );
+    d = (f + 2 <= last) ? fetch( x, s, f + 2, ring_ok, ring_end ) : c;
+    out[i] = x->gain * (b + 0.5f * t * (c - a + t * (2.0f * a - 5.0f * b + 4.0f * c - d
+						       + t * (3.0f * (b - c) + d - a))));
+    pos += (speed[i] > 0 ? speed[i] : 0) * ratio;
+  }
+
+  x->pos = pos;
+  __atomic_store_n( &x->read_pos, (long) pos - SAMPLER_GUARD, __ATOMIC_RELEASE );
+  return w + 5;
+}
+
+static void pdsampler_dsp( t_pdsampler *x, t_signal **sp )
+{
+  dsp_add( pdsampler_perform, 4, x, sp[0]->s_vec, sp[1]->s_vec, (t_int) sp[0]->s_n );
+}
+
+/****************************************************************/
+/// Create an instance of a Pd 'sampler~' object.
+///
+///  [ sampler~ ]  the signal inlet sets the speed ratio, default 1.  Playback
+///  is forward only; a negative speed holds the current position.
+static void *pdsampler_new( void )
+{
+  t_pdsampler *x = (t_pdsampler *) pd_new(pdsampler_class);
+
+  memset( x->slot, 0, sizeof(x->slot) );
+  x->retired = NULL;
+  x->x_f = 1;
+  x->x_canvas = canvas_getcurrent();
+  x->playing = 0;
+  x->play_slot = 0;
+  x->gain = 1;
+  x->underruns = 0;
+  x->req_slot = NULL;
+  x->req_gen = x->ring_gen = 0;
+  x->read_pos = x->ring_end = 0;
+
+  outlet_new( &x->x_ob, &s_signal );
+  x->x_done = outlet_new( &x->x_ob, &s_bang );
+  x->x_clock = clock_new( x, (t_method) pdsampler_tick );
+
+  x->running = 1;
+  if ( pthread_create( &x->thread, NULL, sampler_readahead, x )) {
+    post("sampler~: unable to start read-ahead thread.");
+    x->running = 0;
+  }
+  return (void *)x;
+}
+
+/****************************************************************/
+/// Release an instance of a Pd 'sampler~' object.
+static void pdsampler_free( t_pdsampler *x )
+{
+  t_sampler_slot *s;
+  int i;
+  if ( x->running ) {
+    x->running = 0;
+    pthread_join( x->thread, NULL );
+  }
+  for ( i = 0; i < SAMPLER_SLOTS; i++ ) if ( x->slot[i] ) release_slot( x->slot[i] );
+  while ( (s = x->retired) ) {
+    x->retired = s->next_retired;
+    release_slot( s );
+  }
+  clock_free( x->x_clock );
+  outlet_free( x->x_done );
+}
+
+/****************************************************************/
+/// Initialization entry point for the Pd 'sampler~' external.
+void sampler_tilde_setup(void)
+{
+  pdsampler_class = class_new( gensym("sampler~"),
+			       (t_newmethod) pdsampler_new,
+			       (t_method) pdsampler_free,
+			       sizeof(t_pdsampler),
+			       0, 0);
+
+  CLASS_MAINSIGNALIN( pdsampler_class, t_pdsampler, x_f );
+  class_addmethod( pdsampler_class, (t_method) pdsampler_dsp, gensym("dsp"), A_CANT, 0 );
+  class_addbang( pdsampler_class, pdsampler_bang );
+  class_addmethod( pdsampler_class, (t_method) pdsampler_load, gensym("load"), A_FLOAT, A_SYMBOL, 0 );
+  class_addmethod( pdsampler_class, (t_method) pdsampler_unload, gensym("unload"), A_FLOAT, 0 );
+  class_addmethod( pdsampler_class, (t_method) pdsampler_play, gensym("play"), A_FLOAT, A_DEFFLOAT, 0 );
+  class_addmethod( pdsampler_class, (t_method) pdsampler_stop, gensym("stop"), 0 );
+}
+
+/****************************************************************/